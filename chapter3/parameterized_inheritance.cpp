@@ -1,16 +1,106 @@
 // Copyright <2018> <Tomoyuki Nakabayashi>
 // This software is released under the Apache 2.0 License, see LICENSE.
 
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
 #include <cstdint>
+#include <istream>
+#include <new>
+#include <ostream>
 #include <string>
 #include <sstream>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
 #include <gtest/gtest.h>
 
 namespace basic_inheritance {
+template <typename Output, std::size_t N>
+void append_literal(Output& out, const char (&literal)[N]) {
+  out.append(literal, N - 1);
+}
+
+template <std::size_t N>
+constexpr std::size_t literal_size(const char (&)[N]) {
+  return N - 1;
+}
+
+// Output for convert_into() that records where each piece lives instead of
+// copying it, so the caller's body bytes reach writev() untouched.
+class segments {
+ public:
+    void append(const char* data, std::size_t size) {
+      if (size == 0) return;
+      iovec segment;
+      segment.iov_base = const_cast<char*>(data);
+      segment.iov_len = size;
+      iov_.push_back(segment);
+      bytes_ += size;
+    }
+
+    const iovec* data() const { return iov_.data(); }
+    std::size_t size() const { return iov_.size(); }
+    std::size_t bytes() const { return bytes_; }
+
+    std::string str() const {
+      std::string result;
+      result.reserve(bytes_);
+      for (const auto& segment : iov_) {
+        result.append(static_cast<const char*>(segment.iov_base), segment.iov_len);
+      }
+      return result;
+    }
+
+    void clear() {
+      iov_.clear();
+      bytes_ = 0;
+    }
+
+ private:
+    std::vector<iovec> iov_;
+    std::size_t bytes_ = 0;
+};
+
+// Reserve the whole output once, then let every layer write in one pass.
+template <typename Decorator>
+std::string render(const Decorator& decorator, const std::string& str) {
+  std::string out;
+  out.reserve(decorator.measure(str));
+  decorator.convert_into(str, out);
+  return out;
+}
+
+// Same as above, but the result is allocated with alloc, e.g. from an arena.
+template <typename Decorator, typename Allocator>
+std::basic_string<char, std::char_traits<char>, Allocator>
+render(const Decorator& decorator, const std::string& str, const Allocator& alloc) {
+  std::basic_string<char, std::char_traits<char>, Allocator> out(alloc);
+  out.reserve(decorator.measure(str));
+  decorator.convert_into(str, out);
+  return out;
+}
+
 class Plain {
  public:
     std::string convert(const std::string& str) const {
-      return str;
+      return render(*this, str);
+    }
+
+    std::size_t measure(const std::string& str) const {
+      return str.size();
+    }
+
+    template <typename Output>
+    void convert_into(const std::string& str, Output& out) const {
+      out.append(str.data(), str.size());
     }
 };
 
@@ -18,7 +108,18 @@ template <typename Base>
 class Bold : public Base {
  public:
     std::string convert(const std::string& str) const {
-      return "<b>" + Base::convert(str) + "</b>";
+      return render(*this, str);
+    }
+
+    std::size_t measure(const std::string& str) const {
+      return literal_size("<b>") + Base::measure(str) + literal_size("</b>");
+    }
+
+    template <typename Output>
+    void convert_into(const std::string& str, Output& out) const {
+      append_literal(out, "<b>");
+      Base::convert_into(str, out);
+      append_literal(out, "</b>");
     }
 };
 
@@ -26,7 +127,139 @@ template <typename Base>
 class Italic : public Base {
  public:
     std::string convert(const std::string& str) const {
-      return "<i>" + Base::convert(str) + "</i>";
+      return render(*this, str);
+    }
+
+    std::size_t measure(const std::string& str) const {
+      return literal_size("<i>") + Base::measure(str) + literal_size("</i>");
+    }
+
+    template <typename Output>
+    void convert_into(const std::string& str, Output& out) const {
+      append_literal(out, "<i>");
+      Base::convert_into(str, out);
+      append_literal(out, "</i>");
+    }
+};
+
+inline bool is_special(char c) {
+  return c == '<' || c == '>' || c == '&' || c == '\'' || c == '"';
+}
+
+// Index of the first byte that must be escaped in HTML, or size if none.
+inline std::size_t find_special(const char* data, std::size_t size) {
+  std::size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i lt = _mm256_set1_epi8('<');
+  const __m256i gt = _mm256_set1_epi8('>');
+  const __m256i amp = _mm256_set1_epi8('&');
+  const __m256i apos = _mm256_set1_epi8('\'');
+  const __m256i quot = _mm256_set1_epi8('"');
+  for (; i + 32 <= size; i += 32) {
+    const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    const __m256i hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, lt), _mm256_cmpeq_epi8(chunk, gt)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, amp),
+                        _mm256_or_si256(_mm256_cmpeq_epi8(chunk, apos),
+                                        _mm256_cmpeq_epi8(chunk, quot))));
+    const uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i lt16 = _mm_set1_epi8('<');
+  const __m128i gt16 = _mm_set1_epi8('>');
+  const __m128i amp16 = _mm_set1_epi8('&');
+  const __m128i apos16 = _mm_set1_epi8('\'');
+  const __m128i quot16 = _mm_set1_epi8('"');
+  for (; i + 16 <= size; i += 16) {
+    const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    const __m128i hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, lt16), _mm_cmpeq_epi8(chunk, gt16)),
+        _mm_or_si128(_mm_cmpeq_epi8(chunk, amp16),
+                     _mm_or_si128(_mm_cmpeq_epi8(chunk, apos16),
+                                  _mm_cmpeq_epi8(chunk, quot16))));
+    const uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hit));
+    if (mask != 0) return i + __builtin_ctz(mask);
+  }
+#endif
+  for (; i < size; ++i) {
+    if (is_special(data[i])) return i;
+  }
+  return size;
+}
+
+// Wraps another output and escapes everything appended to it. Clean runs
+// are forwarded in one piece, so text without special bytes is copied once.
+template <typename Output>
+class escaping_output {
+ public:
+    explicit escaping_output(Output& out) : out_(out) {}
+
+    void append(const char* data, std::size_t size) {
+      for (;;) {
+        const std::size_t clean = find_special(data, size);
+        out_.append(data, clean);
+        if (clean == size) return;
+        switch (data[clean]) {
+          case '<': append_literal(out_, "&lt;"); break;
+          case '>': append_literal(out_, "&gt;"); break;
+          case '&': append_literal(out_, "&amp;"); break;
+          case '\'': append_literal(out_, "&#39;"); break;
+          default: append_literal(out_, "&quot;"); break;
+        }
+        data += clean + 1;
+        size -= clean + 1;
+      }
+    }
+
+ private:
+    Output& out_;
+};
+
+// Output for Escape::measure(): adds up what is appended and counts the
+// bytes escaping_output would replace, in one find_special sweep.
+class counting_output {
+ public:
+    void append(const char* data, std::size_t size) {
+      size_ += size;
+      for (;;) {
+        const std::size_t clean = find_special(data, size);
+        if (clean == size) return;
+        ++specials_;
+        data += clean + 1;
+        size -= clean + 1;
+      }
+    }
+    std::size_t size() const { return size_; }
+    std::size_t specials() const { return specials_; }
+
+ private:
+    std::size_t size_ = 0;
+    std::size_t specials_ = 0;
+};
+
+// Escapes whatever Base renders, so Bold<Escape<Plain>> escapes the text
+// but keeps its own tags.
+template <typename Base>
+class Escape : public Base {
+ public:
+    std::string convert(const std::string& str) const {
+      return render(*this, str);
+    }
+
+    // An upper bound: every special byte is counted as the longest escape,
+    // "&quot;", so measuring sweeps the text once without escaping it.
+    std::size_t measure(const std::string& str) const {
+      counting_output counter;
+      Base::convert_into(str, counter);
+      return counter.size() + counter.specials() * (literal_size("&quot;") - 1);
+    }
+
+    template <typename Output>
+    void convert_into(const std::string& str, Output& out) const {
+      escaping_output<Output> escaped(out);
+      Base::convert_into(str, escaped);
     }
 };
 
@@ -47,13 +280,102 @@ TEST_F(BasicInheritance, Test) {
   EXPECT_EQ("<i><b>Hello</b></i>", s3);
 }
 
+TEST_F(BasicInheritance, ConvertInto) {
+  Italic<Bold<Plain>> ib;
+  const std::string hello = "Hello";
+  EXPECT_EQ(std::string("<i><b>Hello</b></i>").size(), ib.measure(hello));
+
+  std::string out = "> ";
+  out.reserve(out.size() + ib.measure(hello));
+  const char* buffer = out.data();
+  ib.convert_into(hello, out);
+  EXPECT_EQ("> <i><b>Hello</b></i>", out);
+  EXPECT_EQ(buffer, out.data());  // Written in place without reallocation.
+}
+
+TEST_F(BasicInheritance, Escape) {
+  Bold<Escape<Plain>> be;
+  EXPECT_EQ("<b>Hello</b>", be.convert("Hello"));
+  EXPECT_EQ("<b>&lt;a href=&quot;x&quot;&gt;Tom &amp; Jerry&#39;s&lt;/a&gt;</b>",
+            be.convert("<a href=\"x\">Tom & Jerry's</a>"));
+  EXPECT_EQ("&lt;i&gt;x&lt;/i&gt;", Escape<Italic<Plain>>().convert("x"));
+  const std::string quoted = "<a href=\"x\">Tom & Jerry's</a>";
+  EXPECT_LT(be.convert(quoted).size(), be.measure(quoted));  // An upper bound.
+
+  // Put a special byte at every offset to cover the vector and scalar tails.
+  for (std::size_t size = 0; size < 80; ++size) {
+    std::string clean(size, 'a');
+    EXPECT_EQ(size, find_special(clean.data(), clean.size()));
+    EXPECT_EQ(clean, Escape<Plain>().convert(clean));
+    for (std::size_t pos = 0; pos < size; ++pos) {
+      std::string dirty = clean;
+      dirty[pos] = '&';
+      EXPECT_EQ(pos, find_special(dirty.data(), dirty.size()));
+      EXPECT_EQ(size + 5, Escape<Plain>().measure(dirty));
+      EXPECT_EQ(size + 4, Escape<Plain>().convert(dirty).size());
+    }
+  }
+}
+
 }  // namespace basic_inheritance
 
 namespace virtualized_inheritance {
+using basic_inheritance::append_literal;
+using basic_inheritance::literal_size;
+using basic_inheritance::segments;
+
+// Any other output, such as a string with its own allocator, reaches the
+// layers through this interface at the cost of one virtual call per piece.
+class output {
+ public:
+    virtual void append(const char* data, std::size_t size) = 0;
+
+ protected:
+    ~output() = default;
+};
+
+template <typename Output>
+class output_adapter final : public output {
+ public:
+    explicit output_adapter(Output& out) : out_(out) {}
+
+    void append(const char* data, std::size_t size) override {
+      out_.append(data, size);
+    }
+
+ private:
+    Output& out_;
+};
+
 class Plain {
  public:
     virtual std::string convert(const std::string& str) const {
-      return str;
+      std::string out;
+      out.reserve(measure(str));
+      convert_into(str, out);
+      return out;
+    }
+
+    virtual std::size_t measure(const std::string& str) const {
+      return str.size();
+    }
+
+    virtual void convert_into(const std::string& str, std::string& out) const {
+      out.append(str);
+    }
+
+    virtual void convert_into(const std::string& str, segments& out) const {
+      out.append(str.data(), str.size());
+    }
+
+    virtual void convert_into(const std::string& str, output& out) const {
+      out.append(str.data(), str.size());
+    }
+
+    template <typename Output>
+    void convert_into(const std::string& str, Output& out) const {
+      output_adapter<Output> adapter(out);
+      convert_into(str, static_cast<output&>(adapter));
     }
 };
 
@@ -61,9 +383,30 @@ template <typename Base = Plain>
 class Bold : public Base {
  public:
     using Base::Base;  // Inherit constructor.
+    using Base::convert_into;
 
-    std::string convert(const std::string &str) const override {
-      return "<b>" + Base::convert(str) + "</b>";
+    std::size_t measure(const std::string& str) const override {
+      return literal_size("<b>") + Base::measure(str) + literal_size("</b>");
+    }
+
+    void convert_into(const std::string& str, std::string& out) const override {
+      write(str, out);
+    }
+
+    void convert_into(const std::string& str, segments& out) const override {
+      write(str, out);
+    }
+
+    void convert_into(const std::string& str, output& out) const override {
+      write(str, out);
+    }
+
+ private:
+    template <typename Output>
+    void write(const std::string& str, Output& out) const {
+      append_literal(out, "<b>");
+      Base::convert_into(str, out);
+      append_literal(out, "</b>");
     }
 };
 
@@ -71,9 +414,30 @@ template <typename Base = Plain>
 class Italic : public Base {
  public:
     using Base::Base;  // Inherit constructor.
+    using Base::convert_into;
+
+    virtual std::size_t measure(const std::string& str) const override {
+      return literal_size("<i>") + Base::measure(str) + literal_size("</i>");
+    }
+
+    virtual void convert_into(const std::string& str, std::string& out) const override {
+      write(str, out);
+    }
+
+    virtual void convert_into(const std::string& str, segments& out) const override {
+      write(str, out);
+    }
 
-    virtual std::string convert(const std::string &str) const override {
-      return "<i>" + Base::convert(str) + "</i>";
+    virtual void convert_into(const std::string& str, output& out) const override {
+      write(str, out);
+    }
+
+ private:
+    template <typename Output>
+    void write(const std::string& str, Output& out) const {
+      append_literal(out, "<i>");
+      Base::convert_into(str, out);
+      append_literal(out, "</i>");
     }
 };
 
@@ -81,17 +445,36 @@ template <typename Base = Plain>
 class Size : public Base {
  public:
     using Base::Base;  // Inherit constructor.
-    Size(int32_t s) {
-      std::ostringstream ostrm;
-      ostrm << s;
-      size_ = ostrm.str();
+    using Base::convert_into;
+    Size(int32_t s) : size_(std::to_string(s)) {}
+
+    virtual std::size_t measure(const std::string& str) const override {
+      return literal_size("<font size='") + size_.size() + literal_size("'>") +
+             Base::measure(str) + literal_size("</font>");
+    }
+
+    virtual void convert_into(const std::string& str, std::string& out) const override {
+      write(str, out);
+    }
+
+    virtual void convert_into(const std::string& str, segments& out) const override {
+      write(str, out);
     }
 
-    virtual std::string convert(const std::string &str) const override {
-      return "<font size='" + size_ + "'>" + Base::convert(str) + "</font>";
+    virtual void convert_into(const std::string& str, output& out) const override {
+      write(str, out);
     }
 
  private:
+    template <typename Output>
+    void write(const std::string& str, Output& out) const {
+      append_literal(out, "<font size='");
+      out.append(size_.data(), size_.size());
+      append_literal(out, "'>");
+      Base::convert_into(str, out);
+      append_literal(out, "</font>");
+    }
+
     std::string size_;
 };
 
@@ -112,4 +495,600 @@ TEST_F(VirtualizedInheritance, Test) {
   EXPECT_EQ("<i><font size='3'>Hello</font></i>", is.convert("Hello"));
 }
 
+TEST_F(VirtualizedInheritance, ConvertInto) {
+  Size<Bold<Italic<>>> sbi(5);
+  const Plain& p = sbi;
+  const std::string hello = "Hello";
+  EXPECT_EQ(sbi.convert(hello).size(), p.measure(hello));
+
+  std::string out;
+  out.reserve(p.measure(hello));
+  const char* buffer = out.data();
+  p.convert_into(hello, out);
+  EXPECT_EQ("<font size='5'><b><i>Hello</i></b></font>", out);
+  EXPECT_EQ(buffer, out.data());  // Written in place without reallocation.
+}
+
 }  // namespace virtualized_inheritance
+
+namespace runtime_composition {
+using basic_inheritance::render;
+
+// One layer of a chain whose order is read at run time, e.g. from config.
+struct Decorator {
+  enum class Kind { bold, italic, size };
+
+  static Decorator bold() { return Decorator{Kind::bold, 0}; }
+  static Decorator italic() { return Decorator{Kind::italic, 0}; }
+  static Decorator size(int32_t s) { return Decorator{Kind::size, s}; }
+
+  Kind kind;
+  int32_t size_value;
+};
+
+// The layers folded into a single prefix and suffix, so rendering is two
+// appends around the body with no virtual calls and no recursion.
+class Chain {
+ public:
+    std::string convert(const std::string& str) const {
+      return render(*this, str);
+    }
+
+    std::size_t measure(const std::string& str) const {
+      return prefix_.size() + str.size() + suffix_.size();
+    }
+
+    template <typename Output>
+    void convert_into(const std::string& str, Output& out) const {
+      out.append(prefix_.data(), prefix_.size());
+      out.append(str.data(), str.size());
+      out.append(suffix_.data(), suffix_.size());
+    }
+
+    const std::string& prefix() const { return prefix_; }
+    const std::string& suffix() const { return suffix_; }
+
+ private:
+    friend Chain compile(const std::vector<Decorator>& decorators);
+
+    Chain(std::string prefix, std::string suffix)
+        : prefix_(std::move(prefix)), suffix_(std::move(suffix)) {}
+
+    std::string prefix_;
+    std::string suffix_;
+};
+
+// Decorators are listed outermost first, so {size(5), bold(), italic()}
+// renders like Size<Bold<Italic<>>>.
+inline Chain compile(const std::vector<Decorator>& decorators) {
+  std::string prefix;
+  std::vector<std::string> suffixes;
+  suffixes.reserve(decorators.size());
+  for (const auto& decorator : decorators) {
+    switch (decorator.kind) {
+      case Decorator::Kind::bold:
+        prefix += "<b>";
+        suffixes.push_back("</b>");
+        break;
+      case Decorator::Kind::italic:
+        prefix += "<i>";
+        suffixes.push_back("</i>");
+        break;
+      case Decorator::Kind::size:
+        prefix += "<font size='" + std::to_string(decorator.size_value) + "'>";
+        suffixes.push_back("</font>");
+        break;
+    }
+  }
+
+  std::string suffix;
+  for (auto it = suffixes.rbegin(); it != suffixes.rend(); ++it) {
+    suffix += *it;
+  }
+  return Chain(std::move(prefix), std::move(suffix));
+}
+
+class RuntimeComposition : public ::testing::Test {
+};
+
+TEST_F(RuntimeComposition, MatchesVirtualizedChain) {
+  const Chain sbi = compile({Decorator::size(5), Decorator::bold(), Decorator::italic()});
+  const Chain is = compile({Decorator::italic(), Decorator::size(3)});
+  const Chain plain = compile({});
+
+  EXPECT_EQ(virtualized_inheritance::Size<virtualized_inheritance::Bold<
+                virtualized_inheritance::Italic<>>>(5).convert("Hello"),
+            sbi.convert("Hello"));
+  EXPECT_EQ("<i><font size='3'>Hello</font></i>", is.convert("Hello"));
+  EXPECT_EQ("Hello", plain.convert("Hello"));
+  EXPECT_EQ("<font size='5'><b><i>", sbi.prefix());
+  EXPECT_EQ("</i></b></font>", sbi.suffix());
+}
+
+}  // namespace runtime_composition
+
+namespace folded_inheritance {
+// A fixed-size string usable in constant expressions, so a whole chain of
+// tags can be concatenated by the compiler.
+template <std::size_t N>
+class static_string {
+ public:
+    constexpr static_string() : chars_{} {}
+
+    constexpr static_string(const char (&literal)[N + 1]) : chars_{} {
+      for (std::size_t i = 0; i < N; ++i) chars_[i] = literal[i];
+    }
+
+    constexpr std::size_t size() const { return N; }
+    constexpr const char* data() const { return chars_; }
+    constexpr char operator[](std::size_t i) const { return chars_[i]; }
+
+    std::string str() const { return std::string(chars_, N); }
+
+    template <std::size_t M>
+    constexpr static_string<N + M> operator+(const static_string<M>& rhs) const {
+      static_string<N + M> result;
+      for (std::size_t i = 0; i < N; ++i) result.chars_[i] = chars_[i];
+      for (std::size_t i = 0; i < M; ++i) result.chars_[N + i] = rhs[i];
+      return result;
+    }
+
+    template <std::size_t M>
+    constexpr bool operator==(const char (&rhs)[M]) const {
+      if (M != N + 1) return false;
+      for (std::size_t i = 0; i < N; ++i) {
+        if (chars_[i] != rhs[i]) return false;
+      }
+      return true;
+    }
+
+ private:
+    template <std::size_t> friend class static_string;
+
+    char chars_[N + 1];
+};
+
+template <std::size_t N>
+constexpr static_string<N - 1> literal(const char (&str)[N]) {
+  return static_string<N - 1>(str);
+}
+
+constexpr std::size_t count_digits(int64_t n) {
+  std::size_t digits = n < 0 ? 2 : 1;
+  for (n /= 10; n != 0; n /= 10) ++digits;
+  return digits;
+}
+
+template <int32_t N>
+constexpr static_string<count_digits(N)> to_static_string() {
+  char digits[count_digits(N) + 1] = {};
+  int64_t n = N < 0 ? -static_cast<int64_t>(N) : N;
+  std::size_t i = count_digits(N);
+  do {
+    digits[--i] = static_cast<char>('0' + n % 10);
+    n /= 10;
+  } while (n != 0);
+  if (N < 0) digits[0] = '-';
+  return static_string<count_digits(N)>(digits);
+}
+
+// The prefix and suffix of a whole chain, each stored once in read-only data.
+template <typename Decorator>
+struct folded {
+  static constexpr decltype(Decorator::prefix()) prefix = Decorator::prefix();
+  static constexpr decltype(Decorator::suffix()) suffix = Decorator::suffix();
+
+  static std::size_t measure(const std::string& str) {
+    return prefix.size() + str.size() + suffix.size();
+  }
+
+  template <typename Output>
+  static void convert_into(const std::string& str, Output& out) {
+    out.append(prefix.data(), prefix.size());
+    out.append(str.data(), str.size());
+    out.append(suffix.data(), suffix.size());
+  }
+
+  static std::string convert(const std::string& str) {
+    std::string out;
+    out.reserve(measure(str));
+    convert_into(str, out);
+    return out;
+  }
+
+  template <std::size_t N>
+  static constexpr auto render(const static_string<N>& str) {
+    return Decorator::prefix() + str + Decorator::suffix();
+  }
+};
+
+template <typename Decorator>
+constexpr decltype(Decorator::prefix()) folded<Decorator>::prefix;
+
+template <typename Decorator>
+constexpr decltype(Decorator::suffix()) folded<Decorator>::suffix;
+
+class Plain {
+ public:
+    static constexpr static_string<0> prefix() { return static_string<0>(); }
+    static constexpr static_string<0> suffix() { return static_string<0>(); }
+
+    std::string convert(const std::string& str) const {
+      return folded<Plain>::convert(str);
+    }
+};
+
+template <typename Base = Plain>
+class Bold : public Base {
+ public:
+    static constexpr auto prefix() { return literal("<b>") + Base::prefix(); }
+    static constexpr auto suffix() { return Base::suffix() + literal("</b>"); }
+
+    std::string convert(const std::string& str) const {
+      return folded<Bold>::convert(str);
+    }
+};
+
+template <typename Base = Plain>
+class Italic : public Base {
+ public:
+    static constexpr auto prefix() { return literal("<i>") + Base::prefix(); }
+    static constexpr auto suffix() { return Base::suffix() + literal("</i>"); }
+
+    std::string convert(const std::string& str) const {
+      return folded<Italic>::convert(str);
+    }
+};
+
+template <int32_t N, typename Base = Plain>
+class Size : public Base {
+ public:
+    static constexpr auto prefix() {
+      return literal("<font size='") + to_static_string<N>() + literal("'>") + Base::prefix();
+    }
+    static constexpr auto suffix() { return Base::suffix() + literal("</font>"); }
+
+    std::string convert(const std::string& str) const {
+      return folded<Size>::convert(str);
+    }
+};
+
+class FoldedInheritance : public ::testing::Test {
+};
+
+TEST_F(FoldedInheritance, Test) {
+  static_assert(folded<Italic<Size<3>>>::prefix == "<i><font size='3'>", "folded prefix");
+  static_assert(folded<Italic<Size<3>>>::suffix == "</font></i>", "folded suffix");
+  static_assert(folded<Size<-12>>::prefix == "<font size='-12'>", "negative size");
+
+  constexpr auto rendered = folded<Bold<Italic<>>>::render(literal("Hello"));
+  static_assert(rendered == "<b><i>Hello</i></b>", "rendered at compile time");
+
+  Size<5, Bold<Italic<>>> sbi;
+  Italic<Size<3>> is;
+  EXPECT_EQ("Hello", Plain().convert("Hello"));
+  EXPECT_EQ("<font size='5'><b><i>Hello</i></b></font>", sbi.convert("Hello"));
+  EXPECT_EQ("<i><font size='3'>Hello</font></i>", is.convert("Hello"));
+}
+
+}  // namespace folded_inheritance
+
+namespace allocator_aware {
+using basic_inheritance::render;
+
+// Bump allocator for request-scoped rendering. Nothing is freed one by one;
+// release() drops everything at once and keeps the newest chunk for reuse.
+class monotonic_arena {
+ public:
+    explicit monotonic_arena(std::size_t chunk_size = 4096) : next_size_(chunk_size) {}
+
+    monotonic_arena(const monotonic_arena&) = delete;
+    monotonic_arena& operator=(const monotonic_arena&) = delete;
+
+    ~monotonic_arena() {
+      release();
+      ::operator delete(current_);
+    }
+
+    void* allocate(std::size_t size, std::size_t alignment) {
+      std::size_t offset = current_ != nullptr ? aligned_offset(alignment) : 0;
+      if (current_ == nullptr || offset + size > current_->capacity) {
+        grow(size + alignment);
+        offset = aligned_offset(alignment);
+      }
+      used_ = offset + size;
+      return current_->data() + offset;
+    }
+
+    void release() {
+      if (current_ == nullptr) return;
+      chunk* old = current_->next;
+      while (old != nullptr) {
+        chunk* next = old->next;
+        ::operator delete(old);
+        old = next;
+      }
+      current_->next = nullptr;
+      used_ = 0;
+      retired_ = 0;
+    }
+
+    // Bytes taken since the last release(), padding included, across chunks.
+    std::size_t bytes_used() const { return retired_ + used_; }
+
+ private:
+    struct alignas(std::max_align_t) chunk {
+      chunk* next;
+      std::size_t capacity;
+
+      char* data() { return reinterpret_cast<char*>(this + 1); }
+    };
+
+    // Offset from data() of the first free byte whose address is a multiple
+    // of alignment. data() itself is only aligned for max_align_t.
+    std::size_t aligned_offset(std::size_t alignment) const {
+      const std::uintptr_t next = reinterpret_cast<std::uintptr_t>(current_->data()) + used_;
+      return used_ + (((next + alignment - 1) & ~(alignment - 1)) - next);
+    }
+
+    void grow(std::size_t min_size) {
+      const std::size_t capacity = std::max(next_size_, min_size);
+      chunk* fresh = static_cast<chunk*>(::operator new(sizeof(chunk) + capacity));
+      fresh->next = current_;
+      fresh->capacity = capacity;
+      if (current_ != nullptr) retired_ += used_;
+      current_ = fresh;
+      used_ = 0;
+      next_size_ = capacity * 2;
+    }
+
+    chunk* current_ = nullptr;
+    std::size_t used_ = 0;
+    std::size_t retired_ = 0;
+    std::size_t next_size_;
+};
+
+template <typename T>
+class arena_allocator {
+ public:
+    typedef T value_type;
+
+    explicit arena_allocator(monotonic_arena& arena) noexcept : arena_(&arena) {}
+
+    template <typename U>
+    arena_allocator(const arena_allocator<U>& other) noexcept : arena_(other.arena()) {}
+
+    T* allocate(std::size_t n) {
+      return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, std::size_t) noexcept {}
+
+    monotonic_arena* arena() const noexcept { return arena_; }
+
+ private:
+    monotonic_arena* arena_;
+};
+
+template <typename T, typename U>
+bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) noexcept {
+  return a.arena() == b.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) noexcept {
+  return !(a == b);
+}
+
+typedef std::basic_string<char, std::char_traits<char>, arena_allocator<char>> arena_string;
+
+class AllocatorAware : public ::testing::Test {
+};
+
+TEST_F(AllocatorAware, RenderIntoArena) {
+  monotonic_arena arena;
+  basic_inheritance::Italic<basic_inheritance::Bold<basic_inheritance::Plain>> ib;
+  const std::string hello(32, 'h');  // Long enough to bypass the small string buffer.
+
+  const arena_string s = render(ib, hello, arena_allocator<char>(arena));
+  EXPECT_EQ(ib.convert(hello), std::string(s.data(), s.size()));
+  EXPECT_LE(ib.measure(hello), arena.bytes_used());
+
+  arena.release();
+  EXPECT_EQ(0u, arena.bytes_used());
+}
+
+TEST_F(AllocatorAware, VirtualizedChain) {
+  monotonic_arena arena;
+  virtualized_inheritance::Size<virtualized_inheritance::Bold<
+      virtualized_inheritance::Italic<>>> sbi(5);
+  const virtualized_inheritance::Plain& p = sbi;
+  const std::string hello(32, 'h');
+
+  const arena_string s = render(p, hello, arena_allocator<char>(arena));
+  EXPECT_EQ(p.convert(hello), std::string(s.data(), s.size()));
+  EXPECT_LE(p.measure(hello), arena.bytes_used());
+}
+
+TEST_F(AllocatorAware, Alignment) {
+  monotonic_arena arena(256);
+  std::size_t requested = 0;
+  for (std::size_t alignment : {1, 8, 64, 256, 1024, 4096}) {
+    void* p = arena.allocate(3, alignment);
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(p) % alignment);
+    requested += 3;
+  }
+  // The later requests do not fit the first chunk; bytes_used() still
+  // counts everything taken from the earlier ones.
+  EXPECT_LE(requested, arena.bytes_used());
+  const std::size_t before = arena.bytes_used();
+  arena.allocate(1000, 1);
+  EXPECT_LE(before + 1000, arena.bytes_used());
+  arena.release();
+  EXPECT_EQ(0u, arena.bytes_used());
+}
+
+TEST_F(AllocatorAware, PerThreadArenas) {
+  const runtime_composition::Chain chain = runtime_composition::compile(
+      {runtime_composition::Decorator::size(5), runtime_composition::Decorator::bold()});
+  const std::string body(64, 'x');
+  const std::string expected = chain.convert(body);
+
+  std::vector<std::thread> threads;
+  std::vector<int> mismatches(4, 0);
+  for (std::size_t t = 0; t < mismatches.size(); ++t) {
+    threads.emplace_back([&, t] {
+      monotonic_arena arena;
+      for (int request = 0; request < 100; ++request) {
+        for (int fragment = 0; fragment < 10; ++fragment) {
+          const arena_string s = render(chain, body, arena_allocator<char>(arena));
+          if (expected.compare(0, expected.size(), s.data(), s.size()) != 0) ++mismatches[t];
+        }
+        arena.release();
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(std::vector<int>(4, 0), mismatches);
+}
+
+}  // namespace allocator_aware
+
+namespace streaming {
+using basic_inheritance::segments;
+
+#ifdef IOV_MAX
+const std::size_t max_segments = IOV_MAX;
+#else
+const std::size_t max_segments = 1024;
+#endif
+
+// Gathers every fragment of [first, last) into out. Prefixes and suffixes
+// refer to the decorator's literals and the bodies to the caller's strings,
+// so both must outlive out.
+template <typename Decorator, typename InputIterator>
+void gather_all(const Decorator& decorator, InputIterator first, InputIterator last,
+                segments& out) {
+  for (; first != last; ++first) {
+    decorator.convert_into(*first, out);
+  }
+}
+
+// writev() until every segment is written, resuming after partial writes.
+inline void write_segments(int fd, const segments& segs) {
+  std::vector<iovec> pending(segs.data(), segs.data() + segs.size());
+  iovec* iov = pending.data();
+  std::size_t count = pending.size();
+  while (count > 0) {
+    const int chunk = static_cast<int>(std::min(count, max_segments));
+    const ssize_t written = ::writev(fd, iov, chunk);
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      throw std::system_error(errno, std::generic_category(), "writev");
+    }
+    std::size_t rest = static_cast<std::size_t>(written);
+    while (count > 0 && rest >= iov->iov_len) {
+      rest -= iov->iov_len;
+      ++iov;
+      --count;
+    }
+    if (rest > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + rest;
+      iov->iov_len -= rest;
+    }
+  }
+}
+
+// Renders [first, last) straight to fd. Segments are flushed once a batch
+// fills a writev() call, so memory stays bounded regardless of input size.
+template <typename Decorator, typename InputIterator>
+std::size_t write_all(int fd, const Decorator& decorator,
+                      InputIterator first, InputIterator last) {
+  segments batch;
+  std::size_t total = 0;
+  for (; first != last; ++first) {
+    decorator.convert_into(*first, batch);
+    if (batch.size() >= max_segments) {
+      write_segments(fd, batch);
+      total += batch.bytes();
+      batch.clear();
+    }
+  }
+  write_segments(fd, batch);
+  return total + batch.bytes();
+}
+
+// Renders each line of in to out, reusing one buffer for every line.
+template <typename Decorator>
+void stream_lines(const Decorator& decorator, std::istream& in, std::ostream& out) {
+  std::string line;
+  std::string buffer;
+  while (std::getline(in, line)) {
+    buffer.clear();
+    decorator.convert_into(line, buffer);
+    buffer.push_back('\n');
+    out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+  }
+}
+
+class Streaming : public ::testing::Test {
+};
+
+TEST_F(Streaming, GatherAll) {
+  virtualized_inheritance::Size<virtualized_inheritance::Bold<
+      virtualized_inheritance::Italic<>>> sbi(5);
+  const std::vector<std::string> bodies = {"Hello", "World"};
+
+  segments segs;
+  gather_all(sbi, bodies.begin(), bodies.end(), segs);
+  EXPECT_EQ(sbi.convert("Hello") + sbi.convert("World"), segs.str());
+
+  // Bodies are referenced in place, not copied.
+  std::size_t referenced = 0;
+  for (std::size_t i = 0; i < segs.size(); ++i) {
+    for (const auto& body : bodies) {
+      if (segs.data()[i].iov_base == body.data()) ++referenced;
+    }
+  }
+  EXPECT_EQ(bodies.size(), referenced);
+}
+
+TEST_F(Streaming, WriteAll) {
+  basic_inheritance::Italic<basic_inheritance::Bold<basic_inheritance::Plain>> ib;
+  const std::vector<std::string> bodies(2000, "x");
+
+  int fds[2];
+  ASSERT_EQ(0, ::pipe(fds));
+  std::string received;
+  const std::size_t written = [&] {
+    // A pipe buffer cannot hold everything, so drain it while writing.
+    std::size_t result = 0;
+    std::thread writer([&] {
+      result = write_all(fds[1], ib, bodies.begin(), bodies.end());
+      ::close(fds[1]);
+    });
+    char chunk[4096];
+    ssize_t n;
+    while ((n = ::read(fds[0], chunk, sizeof(chunk))) > 0) {
+      received.append(chunk, static_cast<std::size_t>(n));
+    }
+    writer.join();
+    ::close(fds[0]);
+    return result;
+  }();
+
+  std::string expected;
+  for (const auto& body : bodies) expected += ib.convert(body);
+  EXPECT_EQ(expected.size(), written);
+  EXPECT_EQ(expected, received);
+}
+
+TEST_F(Streaming, StreamLines) {
+  virtualized_inheritance::Bold<> b;
+  std::istringstream in("Hello\nWorld\n");
+  std::ostringstream out;
+  stream_lines(b, in, out);
+  EXPECT_EQ("<b>Hello</b>\n<b>World</b>\n", out.str());
+}
+
+}  // namespace streaming
@@ -0,0 +1,315 @@
+// Copyright <2018> <Tomoyuki Nakabayashi>
+// This software is released under the Apache 2.0 License, see LICENSE.
+
+// Runtime benchmarks for the decorator chains. The code under test is the
+// test source itself; its tests are compiled in but not run.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include "parameterized_inheritance.cpp"
+
+namespace bench {
+
+// Calls of the global operator new made by this thread.
+thread_local std::size_t allocations = 0;
+
+// Keeps the compiler from discarding a result nobody reads.
+template <typename T>
+void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Best time per call of f over a few rounds of at least 20 ms each.
+template <typename F>
+double ns_per_call(F&& f) {
+  typedef std::chrono::steady_clock clock;
+  std::size_t calls = 1;
+  double best = 0;
+  for (int round = 0; round < 5;) {
+    const auto start = clock::now();
+    for (std::size_t i = 0; i < calls; ++i) f();
+    const double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    if (ns < 20e6) {
+      calls *= 2;
+      continue;
+    }
+    if (round == 0 || ns / calls < best) best = ns / calls;
+    ++round;
+  }
+  return best;
+}
+
+void report(const char* name, std::size_t n, double ns) {
+  std::printf("%-40s %10zu %12.1f ns\n", name, n, ns);
+}
+
+// Average number of heap allocations one call of f makes.
+template <typename F>
+double allocations_per_call(F&& f) {
+  const std::size_t calls = 1000;
+  const std::size_t before = allocations;
+  for (std::size_t i = 0; i < calls; ++i) f();
+  return static_cast<double>(allocations - before) / calls;
+}
+
+// Bytes of input per nanosecond, which is GB/s.
+void report_rate(const char* name, std::size_t n, double ns) {
+  std::printf("%-40s %10zu %12.2f GB/s\n", name, n, n / ns);
+}
+
+void report_allocations(const char* name, std::size_t n, double per_call) {
+  std::printf("%-40s %10zu %12.2f allocations\n", name, n, per_call);
+}
+
+}  // namespace bench
+
+// Counts every allocation; the array and nothrow forms end up here too.
+void* operator new(std::size_t size) {
+  ++bench::allocations;
+  if (void* p = std::malloc(size == 0 ? 1 : size)) return p;
+  throw std::bad_alloc();
+}
+
+// Kept out of line: inlined into a delete expression, free() trips GCC's
+// -Wmismatched-new-delete.
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* p) noexcept { std::free(p); }
+
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace basic_inheritance {
+
+// The rendering before measure()/convert_into(): every layer returns a new
+// string built around the one below it, alternating <b> and <i> from the
+// inside out as the chains below do.
+std::string concatenate(const std::string& str, std::size_t depth) {
+  std::string s = str;
+  for (std::size_t d = 0; d < depth; ++d) {
+    s = d % 2 == 0 ? "<b>" + s + "</b>" : "<i>" + s + "</i>";
+  }
+  return s;
+}
+
+template <typename Decorator>
+void render_rows(const char* depth, const Decorator& decorator, std::size_t layers) {
+  for (std::size_t n : {16, 256, 4096}) {
+    const std::string body(n, 'x');
+    std::string buffer;
+    auto concatenated = [&] { bench::do_not_optimize(concatenate(body, layers)); };
+    auto converted = [&] { bench::do_not_optimize(decorator.convert(body)); };
+    auto converted_into = [&] {
+      buffer.clear();
+      decorator.convert_into(body, buffer);
+      bench::do_not_optimize(buffer);
+    };
+    char name[64];
+    std::snprintf(name, sizeof(name), "render %s/concatenate", depth);
+    bench::report(name, n, bench::ns_per_call(concatenated));
+    bench::report_allocations(name, n, bench::allocations_per_call(concatenated));
+    std::snprintf(name, sizeof(name), "render %s/convert", depth);
+    bench::report(name, n, bench::ns_per_call(converted));
+    bench::report_allocations(name, n, bench::allocations_per_call(converted));
+    std::snprintf(name, sizeof(name), "render %s/convert_into reused buffer", depth);
+    bench::report(name, n, bench::ns_per_call(converted_into));
+    bench::report_allocations(name, n, bench::allocations_per_call(converted_into));
+  }
+}
+
+// Two layers, and eight, where concatenation allocates once per layer but
+// convert() still allocates once.
+void bench_render() {
+  render_rows("depth 2", Italic<Bold<Plain>>(), 2);
+  render_rows("depth 8", Italic<Bold<Italic<Bold<Italic<Bold<Italic<Bold<Plain>>>>>>>>(), 8);
+}
+
+std::size_t find_special_scalar(const char* data, std::size_t size) {
+  for (std::size_t i = 0; i < size; ++i) {
+    if (is_special(data[i])) return i;
+  }
+  return size;
+}
+
+// Throughput over clean text, and text with one special byte every 64.
+// convert() includes the measure() sweep before escaping.
+void bench_escape() {
+  const Escape<Plain> escape;
+  for (std::size_t n : {64, 1024, 65536}) {
+    const std::string clean(n, 'x');
+    std::string dirty = clean;
+    for (std::size_t i = 63; i < n; i += 64) dirty[i] = '&';
+    bench::report_rate("find_special/scalar", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(find_special_scalar(clean.data(), clean.size()));
+    }));
+    bench::report_rate("find_special", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(find_special(clean.data(), clean.size()));
+    }));
+    std::string buffer;
+    bench::report_rate("escape/clean", n, bench::ns_per_call([&] {
+      buffer.clear();
+      escape.convert_into(clean, buffer);
+      bench::do_not_optimize(buffer);
+    }));
+    bench::report_rate("escape/special every 64 bytes", n, bench::ns_per_call([&] {
+      buffer.clear();
+      escape.convert_into(dirty, buffer);
+      bench::do_not_optimize(buffer);
+    }));
+    bench::report_rate("measure+escape/clean", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(escape.convert(clean));
+    }));
+    bench::report_rate("measure+escape/special every 64 bytes", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(escape.convert(dirty));
+    }));
+  }
+}
+
+}  // namespace basic_inheritance
+
+namespace runtime_composition {
+
+// D virtual layers, alternating Bold and Italic from the inside out.
+template <std::size_t D>
+struct virtual_chain {
+  typedef typename virtual_chain<D - 1>::type inner;
+  typedef typename std::conditional<D % 2 == 1, virtualized_inheritance::Bold<inner>,
+                                    virtualized_inheritance::Italic<inner>>::type type;
+};
+
+template <>
+struct virtual_chain<0> {
+  typedef virtualized_inheritance::Plain type;
+};
+
+// The same layers as virtual_chain<D>, outermost first.
+std::vector<Decorator> decorators(std::size_t depth) {
+  std::vector<Decorator> result;
+  for (std::size_t d = depth; d > 0; --d) {
+    result.push_back(d % 2 == 1 ? Decorator::bold() : Decorator::italic());
+  }
+  return result;
+}
+
+// A 256-byte body through chains of every depth from 1 to 16.
+template <std::size_t D>
+void chain_rows() {
+  const typename virtual_chain<D>::type virtual_layers;
+  const virtualized_inheritance::Plain& layers = virtual_layers;
+  const Chain chain = compile(decorators(D));
+  const std::string body(256, 'x');
+  std::string buffer;
+  bench::report("chain of depth n/virtual layers", D, bench::ns_per_call([&] {
+    buffer.clear();
+    layers.convert_into(body, buffer);
+    bench::do_not_optimize(buffer);
+  }));
+  bench::report("chain of depth n/compiled", D, bench::ns_per_call([&] {
+    buffer.clear();
+    chain.convert_into(body, buffer);
+    bench::do_not_optimize(buffer);
+  }));
+}
+
+template <std::size_t... D>
+void chain_rows(std::index_sequence<D...>) {
+  const int expand[] = {0, (chain_rows<D + 1>(), 0)...};
+  static_cast<void>(expand);
+}
+
+void bench_chain() {
+  chain_rows(std::make_index_sequence<16>());
+}
+
+}  // namespace runtime_composition
+
+namespace allocator_aware {
+
+typedef basic_inheritance::Italic<basic_inheritance::Bold<basic_inheritance::Plain>> decorator;
+const std::size_t fragments = 32;
+
+// One request renders 32 fragments and keeps them until it is done.
+void request_with_strings(const decorator& ib, const std::string& body) {
+  std::vector<std::string> kept;
+  kept.reserve(fragments);
+  for (std::size_t i = 0; i < fragments; ++i) kept.push_back(render(ib, body));
+  bench::do_not_optimize(kept);
+}
+
+void request_with_arena(const decorator& ib, const std::string& body, monotonic_arena& arena) {
+  {
+    std::vector<arena_string, arena_allocator<arena_string>> kept{
+        arena_allocator<arena_string>(arena)};
+    kept.reserve(fragments);
+    for (std::size_t i = 0; i < fragments; ++i) {
+      kept.push_back(render(ib, body, arena_allocator<char>(arena)));
+    }
+    bench::do_not_optimize(kept);
+  }
+  arena.release();
+}
+
+// Runs work(requests) on the given number of threads at once and returns the
+// wall time per request over all of them.
+template <typename Work>
+double ns_per_request(std::size_t threads, Work work) {
+  const std::size_t requests = 1 << 13;
+  std::atomic<bool> go{false};
+  std::vector<std::thread> others;
+  for (std::size_t t = 1; t < threads; ++t) {
+    others.emplace_back([&] {
+      while (!go.load(std::memory_order_acquire)) {}
+      work(requests);
+    });
+  }
+  const auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  work(requests);
+  for (auto& t : others) t.join();
+  const double ns = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count();
+  return ns / (requests * threads);
+}
+
+// The renderer serves requests on 1, 2, 4, ... threads up to the hardware,
+// through the global allocator or through one arena per thread. Reports
+// wall time per request.
+void bench_arena() {
+  const decorator ib;
+  const std::size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t n : {16, 256, 4096}) {
+    const std::string body(n, 'x');
+    char strings[64];
+    char arenas[64];
+    std::snprintf(strings, sizeof(strings), "request %zu B/std::string, threads", n);
+    std::snprintf(arenas, sizeof(arenas), "request %zu B/arena per thread, threads", n);
+    for (std::size_t threads = 1;; threads = std::min(2 * threads, hardware)) {
+      bench::report(strings, threads, ns_per_request(threads, [&](std::size_t requests) {
+        for (std::size_t r = 0; r < requests; ++r) request_with_strings(ib, body);
+      }));
+      bench::report(arenas, threads, ns_per_request(threads, [&](std::size_t requests) {
+        monotonic_arena arena;
+        for (std::size_t r = 0; r < requests; ++r) request_with_arena(ib, body, arena);
+      }));
+      if (threads == hardware) break;
+    }
+  }
+}
+
+}  // namespace allocator_aware
+
+int main() {
+  std::printf("%-40s %10s %15s\n", "benchmark", "n", "time/call");
+  basic_inheritance::bench_render();
+  basic_inheritance::bench_escape();
+  runtime_composition::bench_chain();
+  allocator_aware::bench_arena();
+  return 0;
+}
@@ -0,0 +1,185 @@
+# Measures the compile-time cost of meta-function constructs.
+#
+#   cmake -DCXX_COMPILER=g++ -DINCLUDE_DIRS=..
+#         [-DSIZES="10;100"] [-DCONSTRUCTS=at] [-DWORK_DIR=out]
+#         [-DGNU_TIME=/usr/bin/time] -P compile_bench.cmake
+#
+# Every <construct>.cpp.in next to this script is configured for each size N
+# (@N@ is the size, @TYPES@ a list of N distinct types and @LISTS@ N
+# one-element type_lists) and compiled on its own. The templates include
+# meta_function.cpp or typelist.cpp with META_FUNCTION_NO_TESTS defined, so
+# neither gtest nor the tests are compiled, and INCLUDE_DIRS must reach
+# chapter4. The baseline_* rows measure those files alone; subtract them
+# to get the cost of the construct. A template may cap its sizes with a
+# "compile_bench: max_n=<N>" line; larger sizes are recorded as skipped.
+#
+# Wall time, peak RSS (through GNU time, which is required), GC memory
+# (GCC -ftime-report) and instantiations are written to
+# WORK_DIR/compile_bench.csv and WORK_DIR/compile_bench.json.
+# Instantiations are class template specializations from GCC's
+# -fdump-lang-class, or Clang's -ftime-trace instantiation events.
+cmake_minimum_required(VERSION 3.23)  # string(TIMESTAMP) with %f
+
+if(NOT CXX_COMPILER)
+  message(FATAL_ERROR "CXX_COMPILER is required")
+endif()
+if(NOT SOURCE_DIR)
+  set(SOURCE_DIR ${CMAKE_CURRENT_LIST_DIR})
+endif()
+if(NOT WORK_DIR)
+  set(WORK_DIR ${CMAKE_CURRENT_BINARY_DIR}/compile_bench)
+endif()
+if(NOT SIZES)
+  set(SIZES 10 100 1000 10000)
+endif()
+if(NOT CONSTRUCTS)
+  file(GLOB templates RELATIVE ${SOURCE_DIR} ${SOURCE_DIR}/*.cpp.in)
+  string(REPLACE ".cpp.in" "" CONSTRUCTS "${templates}")
+endif()
+if(NOT TIMEOUT)
+  set(TIMEOUT 600)
+endif()
+if(NOT CXX_COMPILER_ID)
+  execute_process(COMMAND ${CXX_COMPILER} --version OUTPUT_VARIABLE version)
+  if(version MATCHES "clang")
+    set(CXX_COMPILER_ID Clang)
+  else()
+    set(CXX_COMPILER_ID GNU)
+  endif()
+endif()
+find_program(GNU_TIME time PATHS /usr/bin /usr/local/bin NO_DEFAULT_PATH)
+if(NOT GNU_TIME)
+  message(FATAL_ERROR "GNU time was not found in /usr/bin or /usr/local/bin; it is needed "
+                      "for peak RSS. Install it or pass -DGNU_TIME=<path>.")
+endif()
+set(include_flags "")
+foreach(dir IN LISTS INCLUDE_DIRS)
+  list(APPEND include_flags -I${dir})
+endforeach()
+
+file(MAKE_DIRECTORY ${WORK_DIR})
+set(csv "construct,n,compiler,status,wall_ms,peak_rss_kb,gc_memory_kb,instantiations\n")
+set(json "")
+
+# Converts GCC's "2225k"/"41M"/"1G" memory figures to kB.
+function(to_kb value out)
+  string(REGEX MATCH "^([0-9]+)([kMG]?)$" _ "${value}")
+  set(kb ${CMAKE_MATCH_1})
+  if(CMAKE_MATCH_2 STREQUAL "M")
+    math(EXPR kb "${kb} * 1024")
+  elseif(CMAKE_MATCH_2 STREQUAL "G")
+    math(EXPR kb "${kb} * 1024 * 1024")
+  elseif(CMAKE_MATCH_2 STREQUAL "")
+    math(EXPR kb "${kb} / 1024")
+  endif()
+  set(${out} ${kb} PARENT_SCOPE)
+endfunction()
+
+foreach(construct IN LISTS CONSTRUCTS)
+  set(max_n "")
+  file(STRINGS ${SOURCE_DIR}/${construct}.cpp.in cap REGEX "compile_bench: max_n=[0-9]+")
+  if(cap MATCHES "max_n=([0-9]+)")
+    set(max_n ${CMAKE_MATCH_1})
+  endif()
+
+  foreach(N IN LISTS SIZES)
+    set(TYPES "tag<0>")
+    set(LISTS "meta_function::type_list<tag<0>>")
+    math(EXPR last "${N} - 1")
+    if(last GREATER 0)
+      foreach(i RANGE 1 ${last})
+        string(APPEND TYPES ", tag<${i}>")
+        string(APPEND LISTS ", meta_function::type_list<tag<${i}>>")
+      endforeach()
+    endif()
+
+    set(source ${WORK_DIR}/${construct}_${N}.cpp)
+    set(object ${WORK_DIR}/${construct}_${N}.o)
+    configure_file(${SOURCE_DIR}/${construct}.cpp.in ${source} @ONLY)
+
+    # The included files need the default depth of 900 on their own.
+    math(EXPR depth "${N} + 900")
+    set(command ${GNU_TIME} -f "peak_rss_kb=%M"
+        ${CXX_COMPILER} -std=c++14 -ftemplate-depth=${depth} ${include_flags}
+        -c ${source} -o ${object})
+    if(CXX_COMPILER_ID MATCHES "Clang")
+      list(APPEND command -ftime-trace -ftime-trace-granularity=0)
+      set(count_classes "")
+    else()
+      # The class dump can run to gigabytes, so it is counted as a stream.
+      list(APPEND command -ftime-report -fdump-lang-class=/dev/stdout)
+      set(count_classes COMMAND grep -c "^Class [^ <]*<")
+    endif()
+
+    set(result 0)
+    set(report "")
+    set(classes "")
+    set(wall_ms "")
+    if(max_n AND N GREATER max_n)
+      set(status skipped)
+    else()
+      string(TIMESTAMP start "%s%f")
+      execute_process(COMMAND ${command} ${count_classes}
+        RESULTS_VARIABLE results
+        OUTPUT_VARIABLE classes
+        ERROR_VARIABLE report
+        OUTPUT_STRIP_TRAILING_WHITESPACE
+        TIMEOUT ${TIMEOUT})
+      string(TIMESTAMP stop "%s%f")
+      math(EXPR wall_ms "(${stop} - ${start}) / 1000")
+      list(GET results 0 result)
+      if(result EQUAL 0)
+        set(status ok)
+      else()
+        set(status failed)
+        string(REGEX MATCH "[^\n]*error[^\n]*" first_error "${report}")
+        message(WARNING "${construct} N=${N} did not compile: ${result}\n${first_error}")
+      endif()
+    endif()
+
+    set(peak_rss_kb "")
+    if(report MATCHES "peak_rss_kb=([0-9]+)")
+      set(peak_rss_kb ${CMAKE_MATCH_1})
+    endif()
+
+    set(gc_memory_kb "")
+    if(report MATCHES "TOTAL[ ]*:[^\n]* ([0-9]+[kMG]?)[ ]*\n")
+      to_kb(${CMAKE_MATCH_1} gc_memory_kb)
+    endif()
+
+    set(instantiations "")
+    if(status STREQUAL "ok")
+      if(CXX_COMPILER_ID MATCHES "Clang" AND EXISTS ${WORK_DIR}/${construct}_${N}.json)
+        file(READ ${WORK_DIR}/${construct}_${N}.json trace)
+        string(REGEX MATCHALL "\"name\":\"Instantiate(Class|Function)\"" events "${trace}")
+        list(LENGTH events instantiations)
+      elseif(NOT CXX_COMPILER_ID MATCHES "Clang")
+        set(instantiations ${classes})
+      endif()
+    endif()
+
+    message(STATUS "${construct} N=${N}: ${status} ${wall_ms} ms")
+    string(APPEND csv "${construct},${N},${CXX_COMPILER_ID},${status},${wall_ms},"
+                      "${peak_rss_kb},${gc_memory_kb},${instantiations}\n")
+
+    foreach(field wall_ms peak_rss_kb gc_memory_kb instantiations)
+      if("${${field}}" STREQUAL "")
+        set(${field}_json null)
+      else()
+        set(${field}_json ${${field}})
+      endif()
+    endforeach()
+    if(NOT json STREQUAL "")
+      string(APPEND json ",\n")
+    endif()
+    string(APPEND json "  {\"construct\": \"${construct}\", \"n\": ${N}, "
+                       "\"compiler\": \"${CXX_COMPILER_ID}\", \"status\": \"${status}\", "
+                       "\"wall_ms\": ${wall_ms_json}, \"peak_rss_kb\": ${peak_rss_kb_json}, "
+                       "\"gc_memory_kb\": ${gc_memory_kb_json}, "
+                       "\"instantiations\": ${instantiations_json}}")
+  endforeach()
+endforeach()
+
+file(WRITE ${WORK_DIR}/compile_bench.csv "${csv}")
+file(WRITE ${WORK_DIR}/compile_bench.json "[\n${json}\n]\n")
+message(STATUS "Results written to ${WORK_DIR}/compile_bench.csv and compile_bench.json")
@@ -1,8 +1,19 @@
 // Copyright <2018> <Tomoyuki Nakabayashi>
 // This software is released under the Apache 2.0 License, see LICENSE.
 
+// META_FUNCTION_NO_TESTS leaves out gtest and the tests, so that the
+// compile_bench templates measure only the meta-functions.
+
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#ifndef META_FUNCTION_NO_TESTS
 #include <gtest/gtest.h>
+#endif
 
 namespace meta_function {
 
@@ -13,6 +24,8 @@ struct increment {
 
 template <int32_t N>
 struct fractorial {
+  static_assert(fractorial<N - 1>::value <= std::numeric_limits<int>::max() / N,
+                "fractorial overflows int");
   static const int value = N * fractorial<N - 1>::value;
 };
 
@@ -21,6 +34,7 @@ struct fractorial<0> {
   static const int value = 1;
 };
 
+#ifndef META_FUNCTION_NO_TESTS
 class MetaFunction : public ::testing::Test {
 };
 
@@ -33,6 +47,7 @@ TEST_F(MetaFunction, Fractorial) {
   int32_t result = fractorial<3>::value;
   EXPECT_EQ(6, result);
 }
+#endif
 
 template <int N>
 struct int_{};
@@ -47,4 +62,191 @@ template <typename T, int N,
 auto add_pointer(T, int_<N>) -> T;
 
 typedef decltype(add_pointer(std::declval<int>(), int_<3>())) result;
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+// numeric_limits is not specialized for 128-bit integers in strict ISO mode,
+// so unsigned types take their maximum from all bits set.
+template <class T>
+constexpr T max_value() {
+  return T(-1) > T(0) ? T(~T(0)) : std::numeric_limits<T>::max();
+}
+
+template <class T>
+constexpr T min_value() {
+  return T(-1) > T(0) ? T(0) : std::numeric_limits<T>::min();
+}
+
+// Compares against the limit on the side the product lands on; dividing by
+// a negative operand flips the comparison.
+template <class T>
+constexpr bool mul_overflows(T a, T b) {
+  return a == 0 || b == 0 ? false
+       : a > 0 ? (b > 0 ? a > max_value<T>() / b : b < min_value<T>() / a)
+       : (b > 0 ? a < min_value<T>() / b : a < max_value<T>() / b);
+}
+
+// Reaching a throw makes the enclosing constant expression ill-formed, so an
+// overflowing table fails to compile instead of wrapping around.
+template <class T>
+constexpr T checked_mul(T a, T b) {
+  return mul_overflows(a, b) ? throw std::overflow_error("table overflow") : T(a * b);
+}
+
+template <class T>
+constexpr T gcd(T a, T b) {
+  while (b != 0) {
+    const T r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+// A generator either computes entry n directly, gen(n), or continues the
+// table from the previous entry, gen.first() and gen.next(previous, n).
+struct is_recurrence_impl {
+  template <class Generator, class T>
+  static auto check(Generator*, T*) -> decltype(
+      std::declval<const Generator&>().next(std::declval<T>(), std::size_t()),
+      std::true_type());
+
+  template <class Generator, class T>
+  static auto check(...) -> std::false_type;
+};
+
+template <class Generator, class T>
+struct is_recurrence
+    : decltype(is_recurrence_impl::check<Generator, T>(nullptr, nullptr)) {};
+
+template <class T, std::size_t N>
+struct table_buffer {
+  T values[N == 0 ? 1 : N];
+};
+
+template <class T, std::size_t N, class Generator>
+constexpr table_buffer<T, N> fill_recurrence(Generator gen) {
+  table_buffer<T, N> buffer{};
+  if (N > 0) buffer.values[0] = gen.first();
+  for (std::size_t n = 1; n < N; ++n) buffer.values[n] = gen.next(buffer.values[n - 1], n);
+  return buffer;
+}
+
+template <class T, std::size_t N, std::size_t... I>
+constexpr std::array<T, N> to_array(const table_buffer<T, N>& buffer, std::index_sequence<I...>) {
+  return {{buffer.values[I]...}};
+}
+
+template <class T, std::size_t N, class Generator, std::size_t... I>
+constexpr std::array<T, N> make_table_impl(Generator gen, std::index_sequence<I...>,
+                                           std::false_type) {
+  return {{gen(I)...}};
+}
+
+template <class T, std::size_t N, class Generator, std::size_t... I>
+constexpr std::array<T, N> make_table_impl(Generator gen, std::index_sequence<I...> indices,
+                                           std::true_type) {
+  return to_array(fill_recurrence<T, N>(gen), indices);
+}
+
+// Every entry comes from a constexpr call rather than its own template
+// instantiation, and a recurrence does O(1) work per entry, so compile cost
+// stays flat as N grows.
+template <class T, std::size_t N, class Generator>
+constexpr std::array<T, N> make_table(Generator gen) {
+  return make_table_impl<T, N>(gen, std::make_index_sequence<N>(),
+                               is_recurrence<Generator, T>());
+}
+
+template <class T, std::size_t N, class Generator>
+struct lookup_table {
+  static constexpr std::array<T, N> value = make_table<T, N>(Generator());
+};
+
+template <class T, std::size_t N, class Generator>
+constexpr std::array<T, N> lookup_table<T, N, Generator>::value;
+
+template <class T>
+struct factorial_generator {
+  constexpr T first() const { return 1; }
+  constexpr T next(T previous, std::size_t n) const { return checked_mul(previous, T(n)); }
+};
+
+template <class T, uint64_t Base>
+struct power_generator {
+  constexpr T first() const { return 1; }
+  constexpr T next(T previous, std::size_t) const { return checked_mul(previous, T(Base)); }
+};
+
+// Row N of Pascal's triangle, i.e. C(N, k), which is 0 for k > N. C(N, k) =
+// C(N, k-1) * (N-k+1) / k; dividing out the common factor of C(N, k-1) and
+// k first leaves k/g dividing N-k+1, so only the result has to fit in T.
+template <class T, std::size_t N>
+struct binomial_generator {
+  constexpr T first() const { return 1; }
+  constexpr T next(T previous, std::size_t k) const {
+    return k > N ? T(0) : next(previous, T(k), gcd(previous, T(k)));
+  }
+
+ private:
+  constexpr T next(T previous, T k, T g) const {
+    return checked_mul(T(previous / g), T(T(N + 1 - k) / T(k / g)));
+  }
+};
+
+// Reflected CRC-32 table, e.g. Polynomial = 0xEDB88320 for zlib.
+template <uint32_t Polynomial>
+struct crc32_generator {
+  constexpr uint32_t operator()(std::size_t n) const {
+    uint32_t crc = static_cast<uint32_t>(n);
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc & 1) ? (crc >> 1) ^ Polynomial : crc >> 1;
+    }
+    return crc;
+  }
+};
+
+#ifndef META_FUNCTION_NO_TESTS
+TEST_F(MetaFunction, LookupTable) {
+  typedef lookup_table<uint64_t, 21, factorial_generator<uint64_t>> factorials;
+  static_assert(factorials::value[12] == 479001600, "12!");
+  static_assert(factorials::value[20] == 2432902008176640000ULL, "20! fits in 64 bits");
+  // lookup_table<uint64_t, 22, factorial_generator<uint64_t>> does not compile.
+
+  typedef lookup_table<uint128_t, 35, factorial_generator<uint128_t>> wide_factorials;
+  static_assert(wide_factorials::value[21] == uint128_t(factorials::value[20]) * 21, "21!");
+
+  typedef lookup_table<uint64_t, 11, binomial_generator<uint64_t, 10>> binomials;
+  static_assert(binomials::value[0] == 1 && binomials::value[5] == 252 &&
+                binomials::value[10] == 1, "C(10, k)");
+  typedef lookup_table<uint64_t, 16, binomial_generator<uint64_t, 10>> padded_binomials;
+  static_assert(padded_binomials::value[10] == 1 && padded_binomials::value[11] == 0 &&
+                padded_binomials::value[15] == 0, "C(10, k) = 0 for k > 10");
+
+  typedef lookup_table<uint64_t, 67, binomial_generator<uint64_t, 66>> row66;
+  static_assert(row66::value[33] == 7219428434016265740ULL && row66::value[66] == 1,
+                "C(66, k) fits in 64 bits");
+
+  static_assert(checked_mul<int64_t>(2, -1) == -2 && checked_mul<int64_t>(-3, -4) == 12,
+                "signed operands");
+  static_assert(checked_mul<int64_t>(std::numeric_limits<int64_t>::min(), 1) ==
+                std::numeric_limits<int64_t>::min(), "signed minimum");
+  // checked_mul<int64_t>(std::numeric_limits<int64_t>::min(), -1) does not compile.
+
+  typedef lookup_table<uint64_t, 64, power_generator<uint64_t, 2>> powers;
+  static_assert(powers::value[63] == (1ULL << 63), "2^63");
+
+  typedef lookup_table<uint32_t, 256, crc32_generator<0xEDB88320>> crc32;
+  static_assert(crc32::value[1] == 0x77073096 && crc32::value[255] == 0x2D02EF8D, "zlib CRC-32");
+
+  // Runtime queries are plain indexed loads from read-only data.
+  volatile std::size_t i = 10;
+  EXPECT_EQ(3628800u, factorials::value[i]);
+  uint32_t crc = ~0u;
+  for (char c : std::string("123456789")) {
+    crc = crc32::value[(crc ^ static_cast<uint8_t>(c)) & 0xFF] ^ (crc >> 8);
+  }
+  EXPECT_EQ(0xCBF43926u, ~crc);
+}
+#endif
 }  // namespace meta_function
@@ -1,15 +1,35 @@
 // Copyright <2018> <Tomoyuki Nakabayashi>
 // This software is released under the Apache 2.0 License, see LICENSE.
 
+// META_FUNCTION_NO_TESTS leaves out gtest and the tests, so that the
+// compile_bench templates measure only the meta-functions.
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#ifndef META_FUNCTION_NO_TESTS
 #include <gtest/gtest.h>
+#endif
 
 namespace meta_function {
 
+template <class... Ts>
+struct type_list {
+  static const std::size_t size = sizeof...(Ts);
+};
+
 template <class Head, class... Tail>
 struct g {
   typedef Head head;
-  typedef std::tuple<Tail...> tail;
+  typedef type_list<Tail...> tail;
 };
 
 template <class... List>
@@ -18,14 +38,724 @@ struct f {
   typedef typename g<List...>::tail tail;
 };
 
-template <template <class> class Pred, class Head, class... Tail>
+// Algorithms over type_list. Everything that can be written as a single pack
+// expansion has O(1) instantiation depth; concat, filter and unique unroll
+// 16 elements per step, so 10,000 types stay far below -ftemplate-depth.
+namespace typelist {
+
+struct not_found {};
+
+template <bool...>
+struct bool_pack {};
+
+template <bool... Bs>
+struct all_true : std::is_same<bool_pack<true, Bs...>, bool_pack<Bs..., true>> {};
+
+// The trailing sentinel keeps the arrays non-empty for an empty pack.
+template <bool... Bs>
+constexpr std::size_t first_true() {
+  const bool flags[] = {Bs..., true};
+  std::size_t i = 0;
+  while (!flags[i]) ++i;
+  return i;
+}
+
+template <bool... Bs>
+constexpr std::size_t count_true() {
+  const bool flags[] = {Bs..., false};
+  std::size_t n = 0;
+  for (bool flag : flags) n += flag;
+  return n;
+}
+
+template <template <class> class Pred, class List>
+struct all_of;
+
+template <template <class> class Pred, class... Ts>
+struct all_of<Pred, type_list<Ts...>> {
+  static const bool value = all_true<Pred<Ts>::value...>::value;
+};
+
+template <template <class> class Pred, class List>
+struct none_of;
+
+template <template <class> class Pred, class... Ts>
+struct none_of<Pred, type_list<Ts...>> {
+  static const bool value = all_true<!Pred<Ts>::value...>::value;
+};
+
+template <template <class> class Pred, class List>
 struct any_of {
-  static const bool value = Pred<Head>::value ? true : any_of<Pred, Tail...>::value;
+  static const bool value = !none_of<Pred, List>::value;
+};
+
+template <template <class> class Pred, class List>
+struct count_if;
+
+template <template <class> class Pred, class... Ts>
+struct count_if<Pred, type_list<Ts...>> {
+  static const std::size_t value = count_true<Pred<Ts>::value...>();
+};
+
+// Position of the first element satisfying Pred, or the list size if none.
+template <template <class> class Pred, class List>
+struct find_index_if;
+
+template <template <class> class Pred, class... Ts>
+struct find_index_if<Pred, type_list<Ts...>> {
+  static const std::size_t value = first_true<Pred<Ts>::value...>();
+};
+
+template <class T, class List>
+struct index_of;
+
+template <class T, class... Ts>
+struct index_of<T, type_list<Ts...>> {
+  static const std::size_t value = first_true<std::is_same<T, Ts>::value...>();
+};
+
+// at<I> picks the I-th base of one class deriving from every element, so the
+// lookup is a single overload resolution instead of I recursive steps.
+template <std::size_t I, class T>
+struct indexed {
+  typedef T type;
+};
+
+template <class Indices, class... Ts>
+struct indexer;
+
+template <std::size_t... I, class... Ts>
+struct indexer<std::index_sequence<I...>, Ts...> : indexed<I, Ts>... {};
+
+template <std::size_t I, class T>
+indexed<I, T> select(const indexed<I, T>&);
+
+template <std::size_t I, class List>
+struct at;
+
+template <std::size_t I, class... Ts>
+struct at<I, type_list<Ts...>> {
+  static_assert(I < sizeof...(Ts), "index out of range");
+  typedef typename decltype(select<I>(
+      indexer<std::index_sequence_for<Ts...>, Ts...>()))::type type;
+};
+
+template <template <class> class Pred, class List>
+struct find_if;
+
+template <template <class> class Pred, class... Ts>
+struct find_if<Pred, type_list<Ts...>> {
+  typedef typename at<find_index_if<Pred, type_list<Ts...>>::value,
+                      type_list<Ts..., not_found>>::type type;
+};
+
+template <template <class> class F, class List>
+struct transform;
+
+template <template <class> class F, class... Ts>
+struct transform<F, type_list<Ts...>> {
+  typedef type_list<typename F<Ts>::type...> type;
+};
+
+template <class... Lists>
+struct concat;
+
+template <>
+struct concat<> {
+  typedef type_list<> type;
+};
+
+template <class... A>
+struct concat<type_list<A...>> {
+  typedef type_list<A...> type;
+};
+
+template <class... A, class... B, class... Rest>
+struct concat<type_list<A...>, type_list<B...>, Rest...>
+    : concat<type_list<A..., B...>, Rest...> {};
+
+template <class... A0, class... A1, class... A2, class... A3, class... A4, class... A5, class... A6, class... A7, class... A8, class... A9, class... A10, class... A11, class... A12, class... A13, class... A14, class... A15, class... Rest>
+struct concat<type_list<A0...>, type_list<A1...>, type_list<A2...>, type_list<A3...>,
+              type_list<A4...>, type_list<A5...>, type_list<A6...>, type_list<A7...>,
+              type_list<A8...>, type_list<A9...>, type_list<A10...>, type_list<A11...>,
+              type_list<A12...>, type_list<A13...>, type_list<A14...>, type_list<A15...>,
+              Rest...>
+    : concat<type_list<A0..., A1..., A2..., A3..., A4..., A5..., A6..., A7..., A8..., A9..., A10..., A11..., A12..., A13..., A14..., A15...>, Rest...> {};
+
+template <template <class> class Pred, class List>
+struct filter;
+
+template <template <class> class Pred, class... Ts>
+struct filter<Pred, type_list<Ts...>>
+    : concat<typename std::conditional<Pred<Ts>::value, type_list<Ts>, type_list<>>::type...> {};
+
+// Left fold of F over Ts. The nested F applications in the unrolled step
+// are evaluated one after another, so they do not add to the depth.
+template <template <class, class> class F, class State, class... Ts>
+struct fold {
+  typedef State type;
+};
+
+template <template <class, class> class F, class State, class T, class... Ts>
+struct fold<F, State, T, Ts...> : fold<F, typename F<State, T>::type, Ts...> {};
+
+template <template <class, class> class F, class State, class T0, class T1, class T2, class T3, class T4, class T5, class T6, class T7, class T8, class T9, class T10, class T11, class T12, class T13, class T14, class T15, class... Ts>
+struct fold<F, State, T0, T1, T2, T3, T4, T5, T6, T7, T8, T9, T10, T11, T12, T13, T14, T15, Ts...>
+    : fold<F, typename F<typename F<typename F<typename F<typename F<typename F<typename F<typename F<typename F<typename F<typename F<typename F<typename F<typename F<typename F<typename F<State, T0>::type, T1>::type, T2>::type, T3>::type, T4>::type, T5>::type, T6>::type, T7>::type, T8>::type, T9>::type, T10>::type, T11>::type, T12>::type, T13>::type, T14>::type, T15>::type,
+           Ts...> {};
+
+template <class T>
+struct identity {
+  typedef T type;
+};
+
+template <class... Ts>
+struct inherit : Ts... {};
+
+template <class Set, class T>
+struct push_unique;
+
+template <class... Seen, class T>
+struct push_unique<type_list<Seen...>, T>
+    : std::conditional<std::is_base_of<identity<T>, inherit<identity<Seen>...>>::value,
+                       type_list<Seen...>, type_list<Seen..., T>> {};
+
+// Keeps the first occurrence of each type. Without a way to hash types this
+// is quadratic in the number of distinct types.
+template <class List>
+struct unique;
+
+template <class... Ts>
+struct unique<type_list<Ts...>> : fold<push_unique, type_list<>, Ts...> {};
+
+// Dense jump table: the runtime ID of a type is its position in the list,
+// and dispatch is one indexed load plus one indirect call.
+template <class List, class Visitor>
+struct dispatch_table {
+  static_assert(List::size != 0, "dispatch needs at least one message type");
+};
+
+// Every overload of the visitor is expected to return the same type as the
+// first one (std::common_type would recurse once per type).
+template <class Head, class... Tail, class Visitor>
+struct dispatch_table<type_list<Head, Tail...>, Visitor> {
+  typedef decltype(std::declval<Visitor&>()(std::declval<const Head&>())) result_type;
+  typedef result_type (*entry)(Visitor&, const void*);
+
+  template <class T>
+  static result_type invoke(Visitor& visitor, const void* message) {
+    return visitor(*static_cast<const T*>(message));
+  }
+
+  static constexpr entry table[] = {&invoke<Head>, &invoke<Tail>...};
+};
+
+template <class Head, class... Tail, class Visitor>
+constexpr typename dispatch_table<type_list<Head, Tail...>, Visitor>::entry
+    dispatch_table<type_list<Head, Tail...>, Visitor>::table[];
+
+// Jump table for messages that arrive as bytes: each entry copies the bytes
+// into a local T before calling the visitor, so the buffer needs no
+// particular alignment.
+template <class List, class Visitor>
+struct decode_table;
+
+template <class... Ts, class Visitor>
+struct decode_table<type_list<Ts...>, Visitor> : dispatch_table<type_list<Ts...>, Visitor> {
+  typedef dispatch_table<type_list<Ts...>, Visitor> base;
+
+  template <class T>
+  static typename base::result_type decode(Visitor& visitor, const void* data) {
+    static_assert(std::is_trivial<T>::value, "messages decoded from bytes must be trivial");
+    T message;
+    std::memcpy(&message, data, sizeof(T));
+    return visitor(static_cast<const T&>(message));
+  }
+
+  static constexpr std::size_t sizes[] = {sizeof(Ts)...};
+  static constexpr typename base::entry table[] = {&decode<Ts>...};
+};
+
+template <class... Ts, class Visitor>
+constexpr std::size_t decode_table<type_list<Ts...>, Visitor>::sizes[];
+
+template <class... Ts, class Visitor>
+constexpr typename dispatch_table<type_list<Ts...>, Visitor>::entry
+    decode_table<type_list<Ts...>, Visitor>::table[];
+
+// A reference to a message together with the position of its type in List.
+// It can only be made from an object whose type is in List, so dispatch()
+// never reads the object as the wrong type.
+template <class List>
+class message_ref {
+ public:
+  // Implicit, so that a message can be passed to dispatch() as it is.
+  template <class T,
+    typename std::enable_if<index_of<T, List>::value != List::size>::type* = nullptr>
+  message_ref(const T& message)
+      : id_(index_of<T, List>::value), message_(&message) {}
+
+  std::size_t id() const { return id_; }
+  const void* get() const { return message_; }
+
+ private:
+  std::size_t id_;
+  const void* message_;
+};
+
+template <class List, class Visitor>
+typename dispatch_table<List, Visitor>::result_type
+dispatch(const message_ref<List>& message, Visitor&& visitor) {
+  typedef dispatch_table<List, Visitor> table;
+  return table::table[message.id()](visitor, message.get());
+}
+
+// External wire tag of a message type; specialize for types without a
+// static tag member.
+template <class T>
+struct tag_of {
+  static const uint32_t value = T::tag;
+};
+
+constexpr uint32_t mix_tag(uint32_t key, uint32_t seed) {
+  uint32_t h = key ^ (seed * 0x9E3779B9u);
+  h ^= h >> 16;
+  h *= 0x85EBCA6Bu;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35u;
+  h ^= h >> 16;
+  return h;
+}
+
+constexpr std::size_t next_pow2(std::size_t n) {
+  std::size_t p = 1;
+  while (p < n) p *= 2;
+  return p;
+}
+
+// Perfect hash from N sparse tags to their list positions, built by
+// hash-and-displace: keys are grouped into buckets, and each bucket, largest
+// first, gets the first seed that moves all its keys into free slots.
+template <std::size_t N>
+struct perfect_hash {
+  static constexpr std::size_t bucket_count = next_pow2(N);
+  static constexpr std::size_t slot_count = 2 * bucket_count;
+  static constexpr std::size_t npos = N;
+
+  uint32_t seeds[bucket_count];
+  uint32_t keys[slot_count];
+  std::size_t index[slot_count];
+
+  static constexpr std::size_t bucket(uint32_t key) {
+    return mix_tag(key, 0) & (bucket_count - 1);
+  }
+
+  static constexpr std::size_t slot(uint32_t key, uint32_t seed) {
+    return mix_tag(key, seed + 1) & (slot_count - 1);
+  }
+
+  constexpr std::size_t find(uint32_t key) const {
+    const std::size_t s = slot(key, seeds[bucket(key)]);
+    return keys[s] == key ? index[s] : npos;
+  }
+};
+
+template <std::size_t N>
+constexpr perfect_hash<N> make_perfect_hash(const uint32_t (&tags)[N]) {
+  typedef perfect_hash<N> hash;
+  const uint32_t unused = tags[0] + 1;  // Cannot match a key in an empty slot.
+  hash result{};
+  for (std::size_t s = 0; s < hash::slot_count; ++s) {
+    result.index[s] = hash::npos;
+    result.keys[s] = unused;
+  }
+
+  // Group key positions by bucket with a counting sort.
+  std::size_t first[hash::bucket_count + 1] = {};
+  std::size_t members[N] = {};
+  for (std::size_t i = 0; i < N; ++i) ++first[hash::bucket(tags[i]) + 1];
+  for (std::size_t b = 0; b < hash::bucket_count; ++b) first[b + 1] += first[b];
+  std::size_t fill[hash::bucket_count] = {};
+  for (std::size_t i = 0; i < N; ++i) {
+    const std::size_t b = hash::bucket(tags[i]);
+    members[first[b] + fill[b]++] = i;
+  }
+
+  std::size_t order[hash::bucket_count] = {};
+  for (std::size_t b = 0; b < hash::bucket_count; ++b) order[b] = b;
+  for (std::size_t b = 1; b < hash::bucket_count; ++b) {
+    const std::size_t current = order[b];
+    const std::size_t size = first[current + 1] - first[current];
+    std::size_t c = b;
+    for (; c > 0 && first[order[c - 1] + 1] - first[order[c - 1]] < size; --c) {
+      order[c] = order[c - 1];
+    }
+    order[c] = current;
+  }
+
+  for (std::size_t b = 0; b < hash::bucket_count; ++b) {
+    const std::size_t begin = first[order[b]];
+    const std::size_t end = first[order[b] + 1];
+    if (begin == end) break;
+    for (std::size_t i = begin; i < end; ++i) {
+      for (std::size_t j = i + 1; j < end; ++j) {
+        if (tags[members[i]] == tags[members[j]]) throw std::logic_error("duplicate tag");
+      }
+    }
+    for (uint32_t seed = 0;; ++seed) {
+      if (seed == 1u << 16) throw std::logic_error("no perfect hash found");
+      std::size_t placed = begin;
+      for (; placed < end; ++placed) {
+        const std::size_t s = hash::slot(tags[members[placed]], seed);
+        if (result.index[s] != hash::npos) break;
+        result.index[s] = members[placed];
+        result.keys[s] = tags[members[placed]];
+      }
+      if (placed == end) {
+        result.seeds[order[b]] = seed;
+        break;
+      }
+      while (placed-- > begin) {
+        const std::size_t s = hash::slot(tags[members[placed]], seed);
+        result.index[s] = hash::npos;
+        result.keys[s] = unused;
+      }
+    }
+  }
+  return result;
+}
+
+template <class List>
+struct tag_index {
+  static_assert(List::size != 0, "tag_index needs at least one message type");
+};
+
+template <class Head, class... Tail>
+struct tag_index<type_list<Head, Tail...>> {
+  static constexpr uint32_t tags[] = {tag_of<Head>::value, tag_of<Tail>::value...};
+  static constexpr perfect_hash<1 + sizeof...(Tail)> hash = make_perfect_hash(tags);
+};
+
+template <class Head, class... Tail>
+constexpr uint32_t tag_index<type_list<Head, Tail...>>::tags[];
+
+template <class Head, class... Tail>
+constexpr perfect_hash<1 + sizeof...(Tail)> tag_index<type_list<Head, Tail...>>::hash;
+
+// Dispatches size bytes of a message on its sparse external tag. Returns
+// false for unknown tags and for sizes that do not match the tagged type.
+template <class List, class Visitor>
+bool dispatch_tag(uint32_t tag, const void* data, std::size_t size, Visitor&& visitor) {
+  typedef decode_table<List, Visitor> table;
+  const std::size_t id = tag_index<List>::hash.find(tag);
+  if (id == List::size || size != table::sizes[id]) return false;
+  table::table[id](visitor, data);
+  return true;
+}
+
+// Contiguous view of one soa_vector column, for vectorizable loops.
+template <class T>
+class column_span {
+ public:
+    column_span(T* data, std::size_t size) : data_(data), size_(size) {}
+
+    T* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    T* begin() const { return data_; }
+    T* end() const { return data_ + size_; }
+    T& operator[](std::size_t i) const { return data_[i]; }
+
+ private:
+    T* data_;
+    std::size_t size_;
+};
+
+const std::size_t column_alignment = 64;
+
+// Cache-line aligned block; the pointer returned by operator new is kept
+// just in front of it.
+inline void* aligned_allocate(std::size_t bytes) {
+  void* raw = ::operator new(bytes + column_alignment + sizeof(void*));
+  const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+  void* aligned = reinterpret_cast<void*>(
+      (start + column_alignment - 1) & ~(std::uintptr_t(column_alignment) - 1));
+  static_cast<void**>(aligned)[-1] = raw;
+  return aligned;
+}
+
+inline void aligned_deallocate(void* p) {
+  if (p != nullptr) ::operator delete(static_cast<void**>(p)[-1]);
+}
+
+// Struct-of-arrays container: every field of Fields... lives in its own
+// aligned column, so a loop over one field touches only that field's bytes.
+template <class... Fields>
+class soa_vector {
+    typedef std::index_sequence_for<Fields...> indices;
+
+ public:
+    typedef type_list<Fields...> fields;
+
+    template <std::size_t I>
+    using field_type = typename typelist::at<I, fields>::type;
+
+    // Proxy for one row; get<I>() reaches into column I.
+    template <class Owner>
+    class basic_row {
+     public:
+        basic_row(Owner& owner, std::size_t index) : owner_(&owner), index_(index) {}
+
+        template <std::size_t I>
+        decltype(auto) get() const { return owner_->template column<I>()[index_]; }
+
+     private:
+        Owner* owner_;
+        std::size_t index_;
+    };
+
+    typedef basic_row<soa_vector> reference;
+    typedef basic_row<const soa_vector> const_reference;
+
+    soa_vector() = default;
+
+    // Delegates first, so a throwing field copy runs the destructor and
+    // frees the rows copied so far.
+    soa_vector(const soa_vector& other) : soa_vector() {
+      reserve(other.size_);
+      for (std::size_t i = 0; i < other.size_; ++i) {
+        push_back_row(other, i, indices());
+      }
+    }
+
+    soa_vector& operator=(const soa_vector& other) {
+      if (this != &other) {
+        soa_vector copy(other);
+        swap(copy);
+      }
+      return *this;
+    }
+
+    soa_vector(soa_vector&& other) noexcept { swap(other); }
+
+    soa_vector& operator=(soa_vector&& other) noexcept {
+      soa_vector moved(std::move(other));
+      swap(moved);
+      return *this;
+    }
+
+    ~soa_vector() {
+      clear();
+      deallocate(data_, indices());
+    }
+
+    void swap(soa_vector& other) noexcept {
+      std::swap(data_, other.data_);
+      std::swap(size_, other.size_);
+      std::swap(capacity_, other.capacity_);
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t capacity() const { return capacity_; }
+    bool empty() const { return size_ == 0; }
+
+    template <std::size_t I>
+    column_span<field_type<I>> column() {
+      return column_span<field_type<I>>(std::get<I>(data_), size_);
+    }
+
+    template <std::size_t I>
+    column_span<const field_type<I>> column() const {
+      return column_span<const field_type<I>>(std::get<I>(data_), size_);
+    }
+
+    reference operator[](std::size_t i) { return reference(*this, i); }
+    const_reference operator[](std::size_t i) const { return const_reference(*this, i); }
+
+    void reserve(std::size_t capacity) {
+      if (capacity <= capacity_) return;
+      std::tuple<Fields*...> fresh;
+      allocate(fresh, capacity, indices());
+      try {
+        transfer(fresh, indices());
+      } catch (...) {
+        deallocate(fresh, indices());
+        throw;
+      }
+      adopt(fresh, capacity);
+    }
+
+    template <class... Values>
+    void push_back(Values&&... values) {
+      static_assert(sizeof...(Values) == sizeof...(Fields), "one value per field");
+      if (size_ < capacity_) {
+        construct_back(data_, indices(), std::forward<Values>(values)...);
+        ++size_;
+        return;
+      }
+      // A value may refer to a row of this container, so the new row is
+      // built in the fresh columns while the old rows are still alive.
+      const std::size_t capacity = capacity_ == 0 ? 16 : capacity_ * 2;
+      std::tuple<Fields*...> fresh;
+      allocate(fresh, capacity, indices());
+      try {
+        construct_back(fresh, indices(), std::forward<Values>(values)...);
+        try {
+          transfer(fresh, indices());
+        } catch (...) {
+          destroy_row(fresh, size_, indices());
+          throw;
+        }
+      } catch (...) {
+        deallocate(fresh, indices());
+        throw;
+      }
+      adopt(fresh, capacity);
+      ++size_;
+    }
+
+    // Removes row i, shifting the following rows of every column down.
+    void erase(std::size_t i) {
+      assert(i < size_);
+      erase_row(i, indices());
+      --size_;
+    }
+
+    void clear() {
+      destroy_from(0, indices());
+      size_ = 0;
+    }
+
+ private:
+    template <class T>
+    static T* allocate_column(std::size_t n) {
+      return static_cast<T*>(aligned_allocate(n * sizeof(T)));
+    }
+
+    template <std::size_t... I>
+    static void allocate(std::tuple<Fields*...>& columns, std::size_t n,
+                         std::index_sequence<I...>) {
+      try {
+        int expand[] = {0, (std::get<I>(columns) = allocate_column<Fields>(n), 0)...};
+        (void)expand;
+      } catch (...) {
+        deallocate(columns, std::index_sequence<I...>());
+        throw;
+      }
+    }
+
+    template <std::size_t... I>
+    static void deallocate(std::tuple<Fields*...>& columns, std::index_sequence<I...>) {
+      int expand[] = {0, (aligned_deallocate(std::get<I>(columns)), std::get<I>(columns) = nullptr, 0)...};
+      (void)expand;
+    }
+
+    // Rows are moved to new columns only if no field can throw doing so;
+    // otherwise they are copied, so a throw leaves the old rows untouched.
+    // Fields that cannot be copied are moved regardless.
+    template <class T>
+    using moves_rows = std::integral_constant<bool,
+        typelist::all_of<std::is_nothrow_move_constructible, fields>::value ||
+        !std::is_copy_constructible<T>::value>;
+
+    template <class T>
+    static typename std::conditional<moves_rows<T>::value, T&&, const T&>::type
+    transfer_value(T& value) {
+      return std::move(value);
+    }
+
+    template <class T>
+    static void transfer_column(T* from, T* to, std::size_t n) {
+      std::size_t i = 0;
+      try {
+        for (; i < n; ++i) new (to + i) T(transfer_value(from[i]));
+      } catch (...) {
+        destroy_column(to, 0, i);
+        throw;
+      }
+    }
+
+    // Builds every column of `to` from the current rows; if a constructor
+    // throws, what was built is destroyed and the current rows remain.
+    template <std::size_t... I>
+    void transfer(std::tuple<Fields*...>& to, std::index_sequence<I...>) {
+      std::size_t built = 0;
+      try {
+        int expand[] = {0, (transfer_column(std::get<I>(data_), std::get<I>(to), size_),
+                            ++built, 0)...};
+        (void)expand;
+      } catch (...) {
+        int expand[] = {0, (I < built ? destroy_column(std::get<I>(to), 0, size_) : void(), 0)...};
+        (void)expand;
+        throw;
+      }
+    }
+
+    // Takes over columns that already hold the current rows.
+    void adopt(std::tuple<Fields*...>& fresh, std::size_t capacity) {
+      destroy_from(0, indices());
+      deallocate(data_, indices());
+      data_ = fresh;
+      capacity_ = capacity;
+    }
+
+    // Constructs row size_ of `columns` column by column; if one constructor
+    // throws the columns already built are unwound.
+    template <std::size_t... I, class... Values>
+    void construct_back(std::tuple<Fields*...>& columns, std::index_sequence<I...>,
+                        Values&&... values) {
+      std::size_t built = 0;
+      try {
+        int expand[] = {0, (new (std::get<I>(columns) + size_) Fields(std::forward<Values>(values)),
+                            ++built, 0)...};
+        (void)expand;
+      } catch (...) {
+        int expand[] = {0, (I < built ? std::get<I>(columns)[size_].~Fields() : void(), 0)...};
+        (void)expand;
+        throw;
+      }
+    }
+
+    template <std::size_t... I>
+    static void destroy_row(std::tuple<Fields*...>& columns, std::size_t row,
+                            std::index_sequence<I...>) {
+      int expand[] = {0, (std::get<I>(columns)[row].~Fields(), 0)...};
+      (void)expand;
+    }
+
+    template <std::size_t... I>
+    void push_back_row(const soa_vector& other, std::size_t row, std::index_sequence<I...>) {
+      push_back(std::get<I>(other.data_)[row]...);
+    }
+
+    template <std::size_t... I>
+    void erase_row(std::size_t row, std::index_sequence<I...>) {
+      int expand[] = {0, (std::move(std::get<I>(data_) + row + 1, std::get<I>(data_) + size_,
+                                    std::get<I>(data_) + row),
+                          std::get<I>(data_)[size_ - 1].~Fields(), 0)...};
+      (void)expand;
+    }
+
+    template <std::size_t... I>
+    void destroy_from(std::size_t row, std::index_sequence<I...>) {
+      int expand[] = {0, (destroy_column(std::get<I>(data_), row, size_), 0)...};
+      (void)expand;
+    }
+
+    template <class T>
+    static void destroy_column(T* column, std::size_t first, std::size_t last) {
+      for (std::size_t i = first; i < last; ++i) column[i].~T();
+    }
+
+    std::tuple<Fields*...> data_;
+    std::size_t size_ = 0;
+    std::size_t capacity_ = 0;
 };
 
-template <template <class> class Pred, class Head>
-struct any_of<Pred, Head> {
-  static const bool value = Pred<Head>::value;
+}  // namespace typelist
+
+template <template <class> class Pred, class... List>
+struct any_of {
+  static const bool value = typelist::any_of<Pred, type_list<List...>>::value;
 };
 
 template <class T>
@@ -38,6 +768,10 @@ struct is_int<int> {
   static const bool value = true;
 };
 
+template <std::size_t I>
+struct tag {};
+
+#ifndef META_FUNCTION_NO_TESTS
 class TypeList : public ::testing::Test {
 };
 
@@ -46,4 +780,256 @@ TEST_F(TypeList, FindInt) {
   EXPECT_TRUE(result);
 }
 
+template <class T>
+struct to_pointer {
+  typedef T* type;
+};
+
+TEST_F(TypeList, Algorithms) {
+  using namespace typelist;
+  typedef type_list<char, int, double, int> list;
+
+  static_assert(std::is_same<f<char, int, double>::tail, type_list<int, double>>::value, "tail");
+  static_assert(typelist::any_of<is_int, list>::value, "any_of");
+  static_assert(!all_of<is_int, list>::value, "all_of");
+  static_assert(none_of<is_int, type_list<char, double>>::value, "none_of");
+  static_assert(!typelist::any_of<is_int, type_list<>>::value, "empty any_of");
+  static_assert(count_if<is_int, list>::value == 2, "count_if");
+  static_assert(index_of<double, list>::value == 2, "index_of");
+  static_assert(index_of<float, list>::value == list::size, "index_of absent");
+  static_assert(std::is_same<at<2, list>::type, double>::value, "at");
+  static_assert(std::is_same<find_if<is_int, list>::type, int>::value, "find_if");
+  static_assert(std::is_same<find_if<is_int, type_list<char>>::type, not_found>::value,
+                "find_if absent");
+  static_assert(std::is_same<transform<to_pointer, type_list<char, int>>::type,
+                             type_list<char*, int*>>::value, "transform");
+  static_assert(std::is_same<filter<is_int, list>::type, type_list<int, int>>::value, "filter");
+  static_assert(std::is_same<concat<type_list<char>, type_list<>, type_list<int, double>>::type,
+                             type_list<char, int, double>>::value, "concat");
+  static_assert(std::is_same<unique<list>::type, type_list<char, int, double>>::value, "unique");
+}
+
+template <class T>
+struct is_last_tag : std::false_type {};
+
+template <>
+struct is_last_tag<tag<1999>> : std::true_type {};
+
+template <class T>
+struct is_even_tag;
+
+template <std::size_t I>
+struct is_even_tag<tag<I>> : std::integral_constant<bool, I % 2 == 0> {};
+
+template <class Indices>
+struct make_tags;
+
+template <std::size_t... I>
+struct make_tags<std::index_sequence<I...>> {
+  typedef type_list<tag<I>...> type;
+};
+
+TEST_F(TypeList, LongList) {
+  // Longer than the default -ftemplate-depth of 900.
+  using namespace typelist;
+  typedef make_tags<std::make_index_sequence<2000>>::type tags;
+
+  static_assert(typelist::any_of<is_last_tag, tags>::value, "any_of");
+  static_assert(std::is_same<find_if<is_last_tag, tags>::type, tag<1999>>::value, "find_if");
+  static_assert(index_of<tag<1500>, tags>::value == 1500, "index_of");
+  static_assert(std::is_same<at<1234, tags>::type, tag<1234>>::value, "at");
+  static_assert(filter<is_even_tag, tags>::type::size == 1000, "filter");
+  static_assert(std::is_same<at<999, filter<is_even_tag, tags>::type>::type, tag<1998>>::value,
+                "filter keeps order");
+}
+
+struct login { static const uint32_t tag = 0x1001; int user; };
+struct logout { static const uint32_t tag = 0x2002; int user; };
+struct heartbeat { static const uint32_t tag = 0xDEADBEEF; };
+
+struct message_printer {
+  std::string operator()(const login& m) const { return "login " + std::to_string(m.user); }
+  std::string operator()(const logout& m) const { return "logout " + std::to_string(m.user); }
+  std::string operator()(const heartbeat&) const { return "heartbeat"; }
+};
+
+TEST_F(TypeList, Dispatch) {
+  using namespace typelist;
+  typedef type_list<login, logout, heartbeat> messages;
+
+  const login in = {7};
+  const logout out = {7};
+  EXPECT_EQ("login 7", dispatch<messages>(in, message_printer()));
+  const message_ref<messages> ref = out;
+  EXPECT_EQ(1u, ref.id());
+  EXPECT_EQ("logout 7", dispatch(ref, message_printer()));
+  static_assert(std::is_convertible<const login&, message_ref<messages>>::value, "");
+  static_assert(!std::is_convertible<const int&, message_ref<messages>>::value,
+                "only types in the list make a message_ref");
+
+  std::string seen;
+  auto record = [&](const auto& m) { seen = message_printer()(m); };
+  const heartbeat beat = {};
+  EXPECT_TRUE(dispatch_tag<messages>(0xDEADBEEF, &beat, sizeof(beat), record));
+  EXPECT_EQ("heartbeat", seen);
+  EXPECT_TRUE(dispatch_tag<messages>(0x1001, &in, sizeof(in), record));
+  EXPECT_EQ("login 7", seen);
+  EXPECT_FALSE(dispatch_tag<messages>(0x3003, &in, sizeof(in), record));
+
+  // A truncated message is rejected rather than read past its end.
+  const char bytes[] = {1, 0};
+  seen.clear();
+  EXPECT_FALSE(dispatch_tag<messages>(0x1001, bytes, sizeof(bytes), record));
+  EXPECT_EQ("", seen);
+}
+
+template <std::size_t I>
+struct numbered_message {
+  static const uint32_t tag = static_cast<uint32_t>(I * 2654435761u + 17);
+};
+
+template <class Indices>
+struct make_messages;
+
+template <std::size_t... I>
+struct make_messages<std::index_sequence<I...>> {
+  typedef type_list<numbered_message<I>...> type;
+};
+
+template <class T>
+struct message_number;
+
+template <std::size_t I>
+struct message_number<numbered_message<I>> {
+  static const std::size_t value = I;
+};
+
+TEST_F(TypeList, DispatchManyTags) {
+  using namespace typelist;
+  typedef make_messages<std::make_index_sequence<512>>::type messages;
+
+  std::size_t seen = 0;
+  auto record = [&](const auto& m) {
+    seen = message_number<typename std::decay<decltype(m)>::type>::value;
+  };
+  const char empty_message = 0;
+  for (std::size_t i = 0; i < 512; ++i) {
+    const uint32_t tag = static_cast<uint32_t>(i * 2654435761u + 17);
+    EXPECT_TRUE(dispatch_tag<messages>(tag, &empty_message, 1, record));
+    EXPECT_EQ(i, seen);
+  }
+  EXPECT_FALSE(dispatch_tag<messages>(18, &empty_message, 1, record));
+}
+
+TEST_F(TypeList, SoaVector) {
+  typelist::soa_vector<float, float, int, std::string> points;
+  for (int i = 0; i < 1000; ++i) {
+    points.push_back(static_cast<float>(i), 2.0f * i, i, std::to_string(i));
+  }
+  ASSERT_EQ(1000u, points.size());
+
+  // Each column is contiguous and cache-line aligned.
+  auto xs = points.column<0>();
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(xs.data()) % typelist::column_alignment);
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(points.column<3>().data()) %
+                typelist::column_alignment);
+  float sum = 0;
+  for (float x : xs) sum += x;
+  EXPECT_EQ(499500.0f, sum);
+
+  points[10].get<1>() = -1.0f;
+  EXPECT_EQ(-1.0f, points.column<1>()[10]);
+  EXPECT_EQ("10", points[10].get<3>());
+
+  points.erase(0);
+  EXPECT_EQ(999u, points.size());
+  EXPECT_EQ(1, points[0].get<2>());
+  EXPECT_EQ("999", points[998].get<3>());
+
+  const typelist::soa_vector<float, float, int, std::string> copy = points;
+  EXPECT_EQ("500", copy[499].get<3>());
+  points.clear();
+  EXPECT_TRUE(points.empty());
+  EXPECT_EQ(999u, copy.size());
+}
+
+TEST_F(TypeList, SoaVectorPushBackOwnRow) {
+  typelist::soa_vector<int, std::string> rows;
+  for (int i = 0; i < 16; ++i) rows.push_back(i, std::string(32, 'a' + i));
+  ASSERT_EQ(rows.size(), rows.capacity());
+
+  // Growing must not destroy the row the arguments refer to.
+  rows.push_back(rows[3].get<0>(), rows[3].get<1>());
+  EXPECT_EQ(17u, rows.size());
+  EXPECT_EQ(3, rows[16].get<0>());
+  EXPECT_EQ(std::string(32, 'd'), rows[16].get<1>());
+}
+
+// Copyable, with a move that may throw, so soa_vector copies it on growth.
+struct fragile {
+  static int copies_left;
+  static int alive;
+
+  explicit fragile(int v) : value(v) { ++alive; }
+  fragile(const fragile& other) : value(other.value) {
+    if (copies_left-- == 0) throw std::runtime_error("copy");
+    ++alive;
+  }
+  fragile(fragile&& other) : fragile(static_cast<const fragile&>(other)) {}
+  ~fragile() { --alive; }
+
+  int value;
+};
+
+int fragile::copies_left = 0;
+int fragile::alive = 0;
+
+TEST_F(TypeList, SoaVectorGrowthThrows) {
+  {
+    typelist::soa_vector<std::string, fragile> rows;
+    fragile::copies_left = 16;
+    for (int i = 0; i < 16; ++i) rows.push_back(std::to_string(i), fragile(i));
+
+    // The copy of a column throws halfway through; the old rows survive.
+    fragile::copies_left = 8;
+    EXPECT_THROW(rows.reserve(64), std::runtime_error);
+    EXPECT_EQ(16u, rows.capacity());
+    EXPECT_EQ(16, fragile::alive);
+    EXPECT_EQ("15", rows[15].get<0>());
+    EXPECT_EQ(15, rows[15].get<1>().value);
+
+    fragile::copies_left = 8;
+    EXPECT_THROW(rows.push_back("16", fragile(16)), std::runtime_error);
+    EXPECT_EQ(16u, rows.size());
+    EXPECT_EQ(16, fragile::alive);
+
+    fragile::copies_left = 1000;
+    rows.push_back("16", fragile(16));
+    EXPECT_EQ(17u, rows.size());
+    EXPECT_EQ(7, rows[7].get<1>().value);
+  }
+  EXPECT_EQ(0, fragile::alive);
+}
+
+TEST_F(TypeList, SoaVectorCopyThrows) {
+  typedef typelist::soa_vector<std::string, fragile> table;
+  {
+    table rows;
+    fragile::copies_left = 1000;
+    for (int i = 0; i < 20; ++i) rows.push_back(std::to_string(i), fragile(i));
+
+    // The copy throws on row 10; the rows copied before it are destroyed.
+    fragile::copies_left = 10;
+    EXPECT_THROW(table copy(rows), std::runtime_error);
+    EXPECT_EQ(20, fragile::alive);
+
+    fragile::copies_left = 1000;
+    const table copy(rows);
+    EXPECT_EQ(40, fragile::alive);
+    EXPECT_EQ(19, copy[19].get<1>().value);
+  }
+  EXPECT_EQ(0, fragile::alive);
+}
+#endif
+
 }  // namespace meta_function
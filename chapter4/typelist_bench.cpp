@@ -0,0 +1,255 @@
+// Copyright <2018> <Tomoyuki Nakabayashi>
+// This software is released under the Apache 2.0 License, see LICENSE.
+
+// Runtime benchmarks for the typelist facilities. The code under test is
+// the test source itself; its tests are compiled in but not run.
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "typelist.cpp"
+
+namespace bench {
+
+// Keeps the compiler from discarding a result nobody reads.
+template <typename T>
+void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Best time per call of f over a few rounds of at least 20 ms each.
+template <typename F>
+double ns_per_call(F&& f) {
+  typedef std::chrono::steady_clock clock;
+  std::size_t calls = 1;
+  double best = 0;
+  for (int round = 0; round < 5;) {
+    const auto start = clock::now();
+    for (std::size_t i = 0; i < calls; ++i) f();
+    const double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    if (ns < 20e6) {
+      calls *= 2;
+      continue;
+    }
+    if (round == 0 || ns / calls < best) best = ns / calls;
+    ++round;
+  }
+  return best;
+}
+
+void report(const char* name, std::size_t n, double ns) {
+  std::printf("%-40s %10zu %12.1f ns\n", name, n, ns);
+}
+
+// Deterministic pseudo-random numbers below bound.
+class random_index {
+ public:
+  explicit random_index(std::size_t bound) : bound_(bound) {}
+  std::size_t operator()() {
+    state_ = state_ * 6364136223846793005u + 1442695040888963407u;
+    return static_cast<std::size_t>(state_ >> 33) % bound_;
+  }
+
+ private:
+  std::size_t bound_;
+  uint64_t state_ = 1;
+};
+
+}  // namespace bench
+
+namespace meta_function {
+namespace dispatch_bench {
+
+template <std::size_t I>
+struct message {
+  static const uint32_t tag = static_cast<uint32_t>(I * 2654435761u + 17);
+  uint32_t value;
+};
+
+// One object of every type; the batch refers to them in random order.
+template <std::size_t I>
+const message<I> instance = {static_cast<uint32_t>(I)};
+
+// The same messages behind a virtual base, for the dynamic_cast chain.
+struct polymorphic_message {
+  explicit polymorphic_message(uint32_t v) : value(v) {}
+  virtual ~polymorphic_message() {}
+  uint32_t value;
+};
+
+template <std::size_t I>
+struct derived_message : polymorphic_message {
+  static const uint32_t tag = message<I>::tag;
+  using polymorphic_message::polymorphic_message;
+};
+
+struct sum_visitor {
+  uint64_t* total;
+  template <class T>
+  void operator()(const T& m) const { *total += m.value + T::tag; }
+};
+
+// What dispatch on a wire tag looks like without a table: compare the tag
+// against every type in turn.
+template <class List>
+struct if_chain;
+
+template <>
+struct if_chain<type_list<>> {
+  static bool visit(uint32_t, const void*, const sum_visitor&) { return false; }
+};
+
+template <class Head, class... Tail>
+struct if_chain<type_list<Head, Tail...>> {
+  static bool visit(uint32_t tag, const void* data, const sum_visitor& visitor) {
+    if (tag == Head::tag) {
+      Head m;
+      std::memcpy(&m, data, sizeof(m));
+      visitor(m);
+      return true;
+    }
+    return if_chain<type_list<Tail...>>::visit(tag, data, visitor);
+  }
+};
+
+template <class List>
+struct cast_chain;
+
+template <>
+struct cast_chain<type_list<>> {
+  static bool visit(const polymorphic_message&, const sum_visitor&) { return false; }
+};
+
+template <class Head, class... Tail>
+struct cast_chain<type_list<Head, Tail...>> {
+  static bool visit(const polymorphic_message& m, const sum_visitor& visitor) {
+    if (const Head* p = dynamic_cast<const Head*>(&m)) {
+      visitor(*p);
+      return true;
+    }
+    return cast_chain<type_list<Tail...>>::visit(m, visitor);
+  }
+};
+
+template <std::size_t I>
+std::unique_ptr<polymorphic_message> make_polymorphic(uint32_t value) {
+  return std::unique_ptr<polymorphic_message>(new derived_message<I>(value));
+}
+
+struct wire_message {
+  uint32_t tag;
+  uint32_t value;
+};
+
+template <std::size_t... I>
+void run(std::index_sequence<I...>) {
+  typedef type_list<message<I>...> messages;
+  typedef type_list<derived_message<I>...> polymorphic_messages;
+  const std::size_t types = sizeof...(I);
+  const std::size_t batch = 4096;
+
+  const typelist::message_ref<messages> refs[] = {instance<I>...};
+  const uint32_t tags[] = {message<I>::tag...};
+  typedef std::unique_ptr<polymorphic_message> (*factory)(uint32_t);
+  const factory make[] = {&make_polymorphic<I>...};
+
+  bench::random_index next(types);
+  std::vector<typelist::message_ref<messages>> in_memory;
+  std::vector<std::unique_ptr<polymorphic_message>> polymorphic;
+  std::vector<wire_message> wire;
+  for (std::size_t k = 0; k < batch; ++k) {
+    const std::size_t i = next();
+    in_memory.push_back(refs[i]);
+    polymorphic.push_back(make[i](static_cast<uint32_t>(i)));
+    wire.push_back(wire_message{tags[i], static_cast<uint32_t>(i)});
+  }
+
+  uint64_t total = 0;
+  const sum_visitor visitor{&total};
+  bench::report("dispatch/dynamic_cast chain", types, bench::ns_per_call([&] {
+    for (const auto& m : polymorphic) cast_chain<polymorphic_messages>::visit(*m, visitor);
+    bench::do_not_optimize(total);
+  }) / batch);
+  bench::report("dispatch/message_ref jump table", types, bench::ns_per_call([&] {
+    for (const auto& m : in_memory) typelist::dispatch(m, visitor);
+    bench::do_not_optimize(total);
+  }) / batch);
+  bench::report("dispatch_tag/if chain", types, bench::ns_per_call([&] {
+    for (const auto& m : wire) if_chain<messages>::visit(m.tag, &m.value, visitor);
+    bench::do_not_optimize(total);
+  }) / batch);
+  bench::report("dispatch_tag/perfect hash", types, bench::ns_per_call([&] {
+    for (const auto& m : wire) {
+      typelist::dispatch_tag<messages>(m.tag, &m.value, sizeof(m.value), visitor);
+    }
+    bench::do_not_optimize(total);
+  }) / batch);
+}
+
+// Time per message, for uniformly random message types.
+void bench_dispatch() {
+  run(std::make_index_sequence<8>());
+  run(std::make_index_sequence<64>());
+  run(std::make_index_sequence<512>());
+}
+
+}  // namespace dispatch_bench
+
+namespace soa_bench {
+
+// A ten-field record, of which the scans read one or two fields.
+struct particle {
+  float x, y, z, vx, vy, vz;
+  int32_t id, flags;
+  double mass, charge;
+};
+
+typedef typelist::soa_vector<float, float, float, float, float, float,
+                             int32_t, int32_t, double, double> particles;
+
+void bench_scan() {
+  for (std::size_t n : {1000, 100000, 1000000}) {
+    std::vector<particle> aos;
+    particles soa;
+    soa.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) {
+      const float f = static_cast<float>(i % 97);
+      const particle p = {f, f, f, f, f, f, int32_t(i), 0, f * 0.5, 1.0};
+      aos.push_back(p);
+      soa.push_back(p.x, p.y, p.z, p.vx, p.vy, p.vz, p.id, p.flags, p.mass, p.charge);
+    }
+    bench::report("scan x/vector<struct>", n, bench::ns_per_call([&] {
+      float sum = 0;
+      for (const particle& p : aos) sum += p.x;
+      bench::do_not_optimize(sum);
+    }));
+    bench::report("scan x/soa_vector column", n, bench::ns_per_call([&] {
+      float sum = 0;
+      for (float x : soa.column<0>()) sum += x;
+      bench::do_not_optimize(sum);
+    }));
+    bench::report("scan x*mass/vector<struct>", n, bench::ns_per_call([&] {
+      double sum = 0;
+      for (const particle& p : aos) sum += p.x * p.mass;
+      bench::do_not_optimize(sum);
+    }));
+    bench::report("scan x*mass/soa_vector columns", n, bench::ns_per_call([&] {
+      const auto x = soa.column<0>();
+      const auto mass = soa.column<8>();
+      double sum = 0;
+      for (std::size_t i = 0; i < x.size(); ++i) sum += x[i] * mass[i];
+      bench::do_not_optimize(sum);
+    }));
+  }
+}
+
+}  // namespace soa_bench
+}  // namespace meta_function
+
+int main() {
+  std::printf("%-40s %10s %15s\n", "benchmark", "n", "time/call");
+  meta_function::dispatch_bench::bench_dispatch();
+  meta_function::soa_bench::bench_scan();
+  return 0;
+}
@@ -1,6 +1,16 @@
 // Copyright <2018> <Tomoyuki Nakabayashi>
 // This software is released under the Apache 2.0 License, see LICENSE.
 
+// SFINAE_INSTRUMENT selects what the overload probes record: 0 compiles
+// them out, 1 counts calls, elements and bytes per call site, and 2 also
+// accumulates the time spent in each, in TSC cycles where available.
+#ifndef SFINAE_INSTRUMENT
+#define SFINAE_INSTRUMENT 0
+#endif
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
 #include <cstdint>
 #include <type_traits>
 #include <utility>
@@ -8,8 +18,29 @@
 #include <list>
 #include <algorithm>
 #include <iterator>
+#include <functional>
+#include <initializer_list>
 #include <cstring>
-#include <iostream>
+#include <sstream>
+#include <cstddef>
+#include <array>
+#include <string>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <numeric>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if SFINAE_INSTRUMENT >= 2 && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#endif
 #include <gtest/gtest.h>
 
 namespace sfinae {
@@ -102,6 +133,207 @@ TEST_F(SFINAE, IsAddable) {
   static_assert(is_addable<int, double>::value, "Is addable.");
 }
 
+struct is_subtractable_impl {
+  template <class T, class U>
+  static auto check(T*, U*) -> decltype(
+    std::declval<T>() - std::declval<U>(),
+    std::true_type());
+
+  template <class T, class U>
+  static auto check(...) -> std::false_type;
+};
+
+template <class T, class U>
+struct is_subtractable
+    : decltype(is_subtractable_impl::check<T, U>(nullptr, nullptr)) {};
+
+struct is_multipliable_impl {
+  template <class T, class U>
+  static auto check(T*, U*) -> decltype(
+    std::declval<T>() * std::declval<U>(),
+    std::true_type());
+
+  template <class T, class U>
+  static auto check(...) -> std::false_type;
+};
+
+template <class T, class U>
+struct is_multipliable
+    : decltype(is_multipliable_impl::check<T, U>(nullptr, nullptr)) {};
+
+// Element-wise arithmetic on arrays without a temporary per operator:
+// `r = a + b + c * d` builds a tree of lightweight nodes, and assigning it
+// runs a single loop that evaluates the whole formula per element. The
+// operators exist only where the element types themselves support them.
+namespace expression {
+
+template <class Derived>
+struct expression {
+  const Derived& self() const { return static_cast<const Derived&>(*this); }
+};
+
+template <class T>
+class array;
+
+// Arrays are held by reference, intermediate nodes by value, so a stored
+// expression stays valid as long as the arrays it names.
+template <class E>
+struct operand { typedef const E type; };
+
+template <class T>
+struct operand<array<T>> { typedef const array<T>& type; };
+
+template <class T>
+class scalar : public expression<scalar<T>> {
+ public:
+  typedef T value_type;
+
+  explicit scalar(const T& value) : value_(value) {}
+  const T& operator[](std::size_t) const { return value_; }
+  std::size_t size() const { return 0; }  // Broadcasts to any size.
+
+ private:
+  T value_;
+};
+
+template <class Op, class L, class R>
+class binary : public expression<binary<Op, L, R>> {
+ public:
+  typedef decltype(Op()(std::declval<typename L::value_type>(),
+                        std::declval<typename R::value_type>())) value_type;
+
+  binary(const L& lhs, const R& rhs) : lhs_(lhs), rhs_(rhs) {
+    assert(lhs.size() == 0 || rhs.size() == 0 || lhs.size() == rhs.size());
+  }
+  value_type operator[](std::size_t i) const { return Op()(lhs_[i], rhs_[i]); }
+  std::size_t size() const { return lhs_.size() ? lhs_.size() : rhs_.size(); }
+
+ private:
+  typename operand<L>::type lhs_;
+  typename operand<R>::type rhs_;
+};
+
+template <class T>
+class array : public expression<array<T>> {
+ public:
+  typedef T value_type;
+
+  array() = default;
+  explicit array(std::size_t n, const T& value = T()) : data_(n, value) {}
+  array(std::initializer_list<T> values) : data_(values) {}
+  template <class E>
+  array(const expression<E>& e) { *this = e; }
+
+  // The fused loop: every element is computed independently from the same
+  // index of each operand, so it is safe even when the destination is one of
+  // the operands, and the compiler is free to vectorize it.
+  template <class E>
+  array& operator=(const expression<E>& e) {
+    const E& source = e.self();
+    const std::size_t n = source.size();
+    if (data_.size() != n) data_.resize(n);
+    T* out = data_.data();
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC ivdep
+#endif
+    for (std::size_t i = 0; i < n; ++i) out[i] = source[i];
+    return *this;
+  }
+
+  const T& operator[](std::size_t i) const { return data_[i]; }
+  T& operator[](std::size_t i) { return data_[i]; }
+  std::size_t size() const { return data_.size(); }
+  const T* data() const { return data_.data(); }
+
+ private:
+  std::vector<T> data_;
+};
+
+template <class T>
+struct is_expression : std::is_base_of<expression<T>, T> {};
+
+// Wraps a plain value as a scalar node and passes expressions through.
+template <class T, bool = is_expression<T>::value>
+struct as_operand {
+  typedef T type;
+  static const T& wrap(const T& e) { return e; }
+};
+
+template <class T>
+struct as_operand<T, false> {
+  typedef scalar<T> type;
+  static scalar<T> wrap(const T& value) { return scalar<T>(value); }
+};
+
+template <class T>
+using value_type_t = typename as_operand<T>::type::value_type;
+
+template <class L, class R>
+struct has_expression_operand
+    : std::integral_constant<bool, is_expression<L>::value || is_expression<R>::value> {};
+
+template <class Op, class L, class R>
+using binary_t = binary<Op, typename as_operand<L>::type, typename as_operand<R>::type>;
+
+template <class Op, class L, class R>
+binary_t<Op, L, R> make_binary(const L& lhs, const R& rhs) {
+  return binary_t<Op, L, R>(as_operand<L>::wrap(lhs), as_operand<R>::wrap(rhs));
+}
+
+template <class L, class R,
+  typename std::enable_if<has_expression_operand<L, R>::value &&
+      is_addable<value_type_t<L>, value_type_t<R>>::value>::type* = nullptr>
+binary_t<std::plus<>, L, R> operator+(const L& lhs, const R& rhs) {
+  return make_binary<std::plus<>>(lhs, rhs);
+}
+
+template <class L, class R,
+  typename std::enable_if<has_expression_operand<L, R>::value &&
+      is_subtractable<value_type_t<L>, value_type_t<R>>::value>::type* = nullptr>
+binary_t<std::minus<>, L, R> operator-(const L& lhs, const R& rhs) {
+  return make_binary<std::minus<>>(lhs, rhs);
+}
+
+template <class L, class R,
+  typename std::enable_if<has_expression_operand<L, R>::value &&
+      is_multipliable<value_type_t<L>, value_type_t<R>>::value>::type* = nullptr>
+binary_t<std::multiplies<>, L, R> operator*(const L& lhs, const R& rhs) {
+  return make_binary<std::multiplies<>>(lhs, rhs);
+}
+
+}  // namespace expression
+
+TEST_F(SFINAE, ExpressionTemplate) {
+  using expression::array;
+  const array<double> a = {1, 2, 3, 4};
+  const array<double> b = {10, 20, 30, 40};
+  const array<double> c = {0.5, 0.5, 2, 2};
+  const array<int> d = {1, 2, 3, 4};
+
+  array<double> r = a + b + c * d;
+  std::vector<double> expect = {11.5, 23, 39, 52};
+  EXPECT_EQ(expect, std::vector<double>(r.data(), r.data() + r.size()));
+
+  r = 2.0 * (r - a) - 1;
+  expect = {20, 41, 71, 95};
+  EXPECT_EQ(expect, std::vector<double>(r.data(), r.data() + r.size()));
+
+  // Nothing is computed until assignment, and a stored tree stays usable.
+  auto lazy = a * b + c;
+  static_assert(!std::is_same<decltype(lazy), array<double>>::value, "Is lazy.");
+  array<double> twice = lazy + lazy;
+  EXPECT_EQ(2 * (1 * 10 + 0.5), twice[0]);
+  EXPECT_EQ(2 * (4 * 40 + 2), twice[3]);
+
+  // Operators follow the element types.
+  static_assert(is_addable<array<int>, array<double>>::value, "Is addable.");
+  static_assert(is_addable<array<addable::B>, array<addable::B>>::value, "Is addable.");
+  static_assert(!is_addable<array<addable::A>, array<addable::A>>::value, "Is not addable.");
+  static_assert(!is_multipliable<array<addable::B>, array<addable::B>>::value,
+                "Is not multipliable.");
+  static_assert(!is_addable<array<double>, std::string>::value, "Is not addable.");
+}
+
 struct has_sort_member_impl {
   template <class T>
   static auto check(T*) -> decltype(
@@ -117,16 +349,330 @@ template <class T>
 struct has_sort_member :
   decltype(has_sort_member_impl::check<T>(nullptr)) {};
 
-template <class Sortable,
+template <class Iterator>
+using iterator_value_t = typename std::iterator_traits<Iterator>::value_type;
+
+// Size limits that pick the algorithm for a random-access range:
+// up to Small elements a sorting network or insertion sort, from Radix
+// elements an LSD radix sort for arithmetic keys, and from Parallel
+// elements a multi-threaded merge sort for everything else.
+template <std::size_t Small = 16, std::size_t Radix = 256, std::size_t Parallel = 1 << 16>
+struct sort_thresholds {
+  static const std::size_t small = Small;
+  static const std::size_t radix = Radix;
+  static const std::size_t parallel = Parallel;
+};
+
+template <class T>
+struct is_radix_sortable : std::integral_constant<bool,
+    ((std::is_integral<T>::value && !std::is_same<T, bool>::value) ||
+     std::is_floating_point<T>::value) &&
+    sizeof(T) <= sizeof(uint64_t)> {};
+
+template <std::size_t Size> struct unsigned_of_size;
+template <> struct unsigned_of_size<1> { typedef uint8_t type; };
+template <> struct unsigned_of_size<2> { typedef uint16_t type; };
+template <> struct unsigned_of_size<4> { typedef uint32_t type; };
+template <> struct unsigned_of_size<8> { typedef uint64_t type; };
+
+// Maps a key to an unsigned integer with the same ordering.
+template <class T>
+typename unsigned_of_size<sizeof(T)>::type radix_key(T value) {
+  typedef typename unsigned_of_size<sizeof(T)>::type key_type;
+  const key_type sign = key_type(1) << (sizeof(T) * 8 - 1);
+  key_type key;
+  std::memcpy(&key, &value, sizeof(T));
+  if (std::is_floating_point<T>::value) {
+    return (key & sign) ? key_type(~key) : key_type(key | sign);
+  }
+  return std::is_signed<T>::value ? key_type(key ^ sign) : key;
+}
+
+template <class RandomAccessIterator>
+void radix_sort(RandomAccessIterator first, RandomAccessIterator last) {
+  typedef iterator_value_t<RandomAccessIterator> value_type;
+  const std::size_t n = last - first;
+  std::vector<value_type> from(first, last);
+  std::vector<value_type> to(n);
+  for (std::size_t shift = 0; shift < sizeof(value_type) * 8; shift += 8) {
+    std::size_t offsets[257] = {};
+    for (const value_type& v : from) ++offsets[((radix_key(v) >> shift) & 0xFF) + 1];
+    if (std::find(std::begin(offsets), std::end(offsets), n) != std::end(offsets)) {
+      continue;  // Every key has the same digit here.
+    }
+    for (std::size_t d = 0; d < 256; ++d) offsets[d + 1] += offsets[d];
+    for (const value_type& v : from) to[offsets[(radix_key(v) >> shift) & 0xFF]++] = v;
+    from.swap(to);
+  }
+  std::copy(from.begin(), from.end(), first);
+}
+
+template <class RandomAccessIterator>
+void compare_swap(RandomAccessIterator a, RandomAccessIterator b) {
+  if (*b < *a) std::iter_swap(a, b);
+}
+
+template <class RandomAccessIterator>
+void small_sort(RandomAccessIterator first, RandomAccessIterator last) {
+  switch (last - first) {
+    case 0:
+    case 1:
+      return;
+    case 2:
+      compare_swap(first, first + 1);
+      return;
+    case 3:
+      compare_swap(first, first + 1);
+      compare_swap(first + 1, first + 2);
+      compare_swap(first, first + 1);
+      return;
+    case 4:
+      compare_swap(first, first + 1);
+      compare_swap(first + 2, first + 3);
+      compare_swap(first, first + 2);
+      compare_swap(first + 1, first + 3);
+      compare_swap(first + 1, first + 2);
+      return;
+    default:
+      for (auto i = first + 1; i != last; ++i) {
+        auto value = std::move(*i);
+        auto j = i;
+        for (; j != first && value < *(j - 1); --j) *j = std::move(*(j - 1));
+        *j = std::move(value);
+      }
+  }
+}
+
+namespace parallel {
+
+// Each worker owns a deque: it takes its own newest task first and, when
+// empty, steals the oldest task of another worker. Threads outside the pool
+// push round-robin.
+class thread_pool {
+ public:
+  explicit thread_pool(std::size_t workers)
+      : queues_(std::max<std::size_t>(workers, 1)) {
+    for (auto& q : queues_) q.reset(new queue);
+    for (std::size_t i = 0; i < queues_.size(); ++i) {
+      threads_.emplace_back([this, i] { work(i); });
+    }
+  }
+
+  ~thread_pool() {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto& t : threads_) t.join();
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  static thread_pool& instance() {
+    static thread_pool pool(std::thread::hardware_concurrency());
+    return pool;
+  }
+
+  std::size_t size() const { return threads_.size(); }
+
+  void submit(std::function<void()> task) {
+    const std::size_t target = current_ == this
+        ? worker_
+        : next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+    // Counted before it is published: a worker may pop and count off the
+    // task as soon as the queue lock is released.
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    try {
+      std::lock_guard<std::mutex> lock(queues_[target]->mutex);
+      queues_[target]->tasks.push_back(std::move(task));
+    } catch (...) {
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+      throw;
+    }
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+    }
+    wake_.notify_one();
+  }
+
+  // Runs one queued task on the calling thread, if there is any. Threads
+  // waiting for their own tasks call this instead of blocking, so nested
+  // parallel calls cannot starve the pool.
+  bool run_one() {
+    std::function<void()> task;
+    if (!pop(current_ == this ? worker_ : 0, task)) return false;
+    task();
+    return true;
+  }
+
+ private:
+  struct queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  bool pop(std::size_t self, std::function<void()>& task) {
+    for (std::size_t k = 0; k < queues_.size(); ++k) {
+      queue& q = *queues_[(self + k) % queues_.size()];
+      std::lock_guard<std::mutex> lock(q.mutex);
+      if (q.tasks.empty()) continue;
+      if (k == 0) {
+        task = std::move(q.tasks.back());
+        q.tasks.pop_back();
+      } else {
+        task = std::move(q.tasks.front());
+        q.tasks.pop_front();
+      }
+      pending_.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+    return false;
+  }
+
+  void work(std::size_t index) {
+    current_ = this;
+    worker_ = index;
+    for (;;) {
+      if (run_one()) continue;
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      wake_.wait(lock, [this] {
+        return stop_ || pending_.load(std::memory_order_acquire) > 0;
+      });
+      if (stop_ && pending_.load(std::memory_order_acquire) == 0) return;
+    }
+  }
+
+  static thread_local thread_pool* current_;
+  static thread_local std::size_t worker_;
+
+  std::vector<std::unique_ptr<queue>> queues_;
+  std::vector<std::thread> threads_;
+  std::atomic<std::size_t> next_{0};
+  std::atomic<std::size_t> pending_{0};
+  std::mutex sleep_mutex_;
+  std::condition_variable wake_;
+  bool stop_ = false;
+};
+
+thread_local thread_pool* thread_pool::current_ = nullptr;
+thread_local std::size_t thread_pool::worker_ = 0;
+
+// Tasks submitted together and waited for together. The first exception
+// thrown by a task is rethrown from wait() once every task has finished.
+class task_group {
+ public:
+  explicit task_group(thread_pool& pool) : pool_(pool) {}
+  ~task_group() { drain(); }
+
+  template <class Function>
+  void run(Function f) {
+    remaining_.fetch_add(1, std::memory_order_relaxed);
+    pool_.submit([this, f] {
+      try {
+        f();
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex_);
+        if (!error_) error_ = std::current_exception();
+      }
+      remaining_.fetch_sub(1, std::memory_order_release);
+    });
+  }
+
+  void wait() {
+    drain();
+    if (error_) std::rethrow_exception(error_);
+  }
+
+ private:
+  void drain() {
+    while (remaining_.load(std::memory_order_acquire) > 0) {
+      if (!pool_.run_one()) std::this_thread::yield();
+    }
+  }
+
+  thread_pool& pool_;
+  std::atomic<std::size_t> remaining_{0};
+  std::mutex error_mutex_;
+  std::exception_ptr error_;
+};
+
+}  // namespace parallel
+
+// Sorts one chunk per pool worker, then merges neighbouring chunks in
+// parallel rounds. An exception thrown by a comparison is rethrown here once
+// every task of the round has finished.
+template <class RandomAccessIterator>
+void parallel_sort(RandomAccessIterator first, RandomAccessIterator last,
+                   parallel::thread_pool& pool = parallel::thread_pool::instance()) {
+  const std::size_t n = last - first;
+  const std::size_t workers = pool.size();
+  const std::size_t chunk = (n + workers - 1) / workers;
+  if (workers == 1) {
+    std::sort(first, last);
+    return;
+  }
+
+  {
+    parallel::task_group group(pool);
+    for (std::size_t begin = 0; begin < n; begin += chunk) {
+      const std::size_t end = std::min(n, begin + chunk);
+      group.run([=] { std::sort(first + begin, first + end); });
+    }
+    group.wait();
+  }
+
+  for (std::size_t width = chunk; width < n; width *= 2) {
+    parallel::task_group group(pool);
+    for (std::size_t begin = 0; begin + width < n; begin += 2 * width) {
+      const std::size_t middle = begin + width;
+      const std::size_t end = std::min(n, begin + 2 * width);
+      group.run([=] { std::inplace_merge(first + begin, first + middle, first + end); });
+    }
+    group.wait();
+  }
+}
+
+template <class Thresholds, class RandomAccessIterator,
+          typename std::enable_if<
+              is_radix_sortable<iterator_value_t<RandomAccessIterator>>::value>::type* = nullptr>
+bool try_radix_sort(RandomAccessIterator first, RandomAccessIterator last) {
+  if (static_cast<std::size_t>(last - first) < Thresholds::radix) return false;
+  radix_sort(first, last);
+  return true;
+}
+
+template <class Thresholds, class RandomAccessIterator,
+          typename std::enable_if<
+              !is_radix_sortable<iterator_value_t<RandomAccessIterator>>::value>::type* = nullptr>
+bool try_radix_sort(RandomAccessIterator, RandomAccessIterator) {
+  return false;
+}
+
+template <class Thresholds, class RandomAccessIterator>
+void sort_range(RandomAccessIterator first, RandomAccessIterator last) {
+  const std::size_t n = last - first;
+  if (n <= Thresholds::small) {
+    small_sort(first, last);
+  } else if (try_radix_sort<Thresholds>(first, last)) {
+  } else if (n >= Thresholds::parallel) {
+    parallel_sort(first, last);
+  } else {
+    std::sort(first, last);
+  }
+}
+
+template <class Thresholds = sort_thresholds<>, class Sortable,
   typename std::enable_if<has_sort_member<Sortable>::value>::type* = nullptr>
 void sort(Sortable &x) {
   x.sort();
 }
 
-template <class Range,
+template <class Thresholds = sort_thresholds<>, class Range,
   typename std::enable_if<!has_sort_member<Range>::value>::type* = nullptr>
 void sort(Range& r) {
-  std::sort(std::begin(r), std::end(r));
+  sort_range<Thresholds>(std::begin(r), std::end(r));
 }
 
 TEST_F(SFINAE, SwitchSort) {
@@ -142,29 +688,782 @@ TEST_F(SFINAE, SwitchSort) {
   EXPECT_EQ(expect_ls, ls);
 }
 
-template <class Iterator,
-          typename std::enable_if<
-                    std::is_pointer<Iterator>::value &&
-                    std::is_trivially_assignable<std::remove_pointer<Iterator>, const std::remove_pointer<Iterator>>::value &&
-                    std::is_trivially_destructible<std::remove_pointer<Iterator>>::value
-                   >::type* = nullptr
-         >
-Iterator copy(Iterator first, Iterator last, Iterator out) {
-  std::cout << "memmove" << std::endl;
-  std::memmove(out, first, (last - first) * sizeof(decltype(*first)));
-  return out + (last - first);
+template <class T>
+std::vector<T> random_values(std::size_t n, uint64_t seed) {
+  std::vector<T> values(n);
+  for (auto& v : values) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    const int64_t bits = static_cast<int64_t>(seed >> 16);
+    v = static_cast<T>(bits % 20001 - 10000) / static_cast<T>(bits % 7 + 1);
+  }
+  return values;
+}
+
+template <class Thresholds, class T>
+void expect_sorted_like_std(std::vector<T> values) {
+  std::vector<T> expect = values;
+  std::sort(expect.begin(), expect.end());
+  sort<Thresholds>(values);
+  EXPECT_EQ(expect, values);
+}
+
+struct throwing_key {
+  static const int poison = 1 << 20;
+  int value;
+
+  bool operator<(const throwing_key& other) const {
+    if (value == poison || other.value == poison) throw std::runtime_error("compare");
+    return value < other.value;
+  }
+};
+
+TEST_F(SFINAE, AdaptiveSort) {
+  typedef sort_thresholds<4, 32, 1000> small_limits;
+  for (std::size_t n : {0, 1, 2, 3, 4, 5, 17, 31, 32, 100, 999, 5000}) {
+    expect_sorted_like_std<small_limits>(random_values<int>(n, n));
+    expect_sorted_like_std<small_limits>(random_values<int8_t>(n, n));
+    expect_sorted_like_std<small_limits>(random_values<uint16_t>(n, n));
+    expect_sorted_like_std<small_limits>(random_values<int64_t>(n, n));
+    expect_sorted_like_std<small_limits>(random_values<float>(n, n));
+    expect_sorted_like_std<small_limits>(random_values<double>(n, n));
+
+    std::vector<std::string> words;
+    for (int v : random_values<int>(n, n)) words.push_back(std::to_string(v));
+    expect_sorted_like_std<small_limits>(words);
+  }
+
+  // Four workers, whatever the hardware: a comparison that throws on a pool
+  // thread reaches the caller.
+  parallel::thread_pool pool(4);
+  std::vector<throwing_key> keys;
+  for (int v : random_values<int>(5000, 1)) keys.push_back(throwing_key{v});
+  std::vector<throwing_key> sorted = keys;
+  parallel_sort(sorted.begin(), sorted.end(), pool);
+  EXPECT_TRUE(std::is_sorted(sorted.begin(), sorted.end()));
+  keys[4321].value = throwing_key::poison;
+  EXPECT_THROW(parallel_sort(keys.begin(), keys.end(), pool), std::runtime_error);
+
+  std::vector<double> signed_zeros = {0.0, -1.5, -0.0, 2.0, -1e300, 1e-300};
+  sort<sort_thresholds<0, 0>>(signed_zeros);
+  EXPECT_TRUE(std::is_sorted(signed_zeros.begin(), signed_zeros.end()));
+
+  static_assert(is_radix_sortable<int>::value, "Radix sortable.");
+  static_assert(is_radix_sortable<double>::value, "Radix sortable.");
+  static_assert(!is_radix_sortable<bool>::value, "Not radix sortable.");
+  static_assert(!is_radix_sortable<std::string>::value, "Not radix sortable.");
+}
+
+// Parallel counterparts of the std algorithms. Ranges with random-access
+// iterators and at least Threshold elements are cut into chunks that run on
+// the given work-stealing pool, the shared one by default; anything else,
+// std::list included, runs the serial algorithm.
+namespace parallel {
+
+const std::size_t parallel_threshold = 1 << 15;
+
+template <class Iterator>
+struct is_random_access_iterator : std::is_base_of<std::random_access_iterator_tag,
+    typename std::iterator_traits<Iterator>::iterator_category> {};
+
+// Several chunks per worker, so that stealing can even out uneven work.
+inline std::size_t chunk_count(std::size_t n, const thread_pool& pool) {
+  const std::size_t chunks = pool.size() * 4;
+  return std::max<std::size_t>(1, std::min(n, chunks));
+}
+
+// Calls body(begin, end, chunk) for every chunk of [0, n) on the pool.
+template <class Body>
+void for_chunks(std::size_t n, std::size_t chunks, thread_pool& pool, Body body) {
+  task_group group(pool);
+  for (std::size_t k = 0; k < chunks; ++k) {
+    const std::size_t begin = n * k / chunks;
+    const std::size_t end = n * (k + 1) / chunks;
+    group.run([=, &body] { body(begin, end, k); });
+  }
+  group.wait();
+}
+
+template <std::size_t Threshold = parallel_threshold, class Iterator, class Function,
+  typename std::enable_if<!is_random_access_iterator<Iterator>::value>::type* = nullptr>
+void for_each(Iterator first, Iterator last, Function f,
+              thread_pool& = thread_pool::instance()) {
+  std::for_each(first, last, f);
+}
+
+template <std::size_t Threshold = parallel_threshold, class Iterator, class Function,
+  typename std::enable_if<is_random_access_iterator<Iterator>::value>::type* = nullptr>
+void for_each(Iterator first, Iterator last, Function f,
+              thread_pool& pool = thread_pool::instance()) {
+  const std::size_t n = last - first;
+  if (n < Threshold) {
+    std::for_each(first, last, f);
+    return;
+  }
+  for_chunks(n, chunk_count(n, pool), pool, [&](std::size_t begin, std::size_t end, std::size_t) {
+    std::for_each(first + begin, first + end, f);
+  });
+}
+
+template <std::size_t Threshold = parallel_threshold,
+  class InputIterator, class OutputIterator, class Function,
+  typename std::enable_if<!is_random_access_iterator<InputIterator>::value ||
+      !is_random_access_iterator<OutputIterator>::value>::type* = nullptr>
+OutputIterator transform(InputIterator first, InputIterator last, OutputIterator out, Function f,
+                         thread_pool& = thread_pool::instance()) {
+  return std::transform(first, last, out, f);
+}
+
+template <std::size_t Threshold = parallel_threshold,
+  class InputIterator, class OutputIterator, class Function,
+  typename std::enable_if<is_random_access_iterator<InputIterator>::value &&
+      is_random_access_iterator<OutputIterator>::value>::type* = nullptr>
+OutputIterator transform(InputIterator first, InputIterator last, OutputIterator out, Function f,
+                         thread_pool& pool = thread_pool::instance()) {
+  const std::size_t n = last - first;
+  if (n < Threshold) return std::transform(first, last, out, f);
+  for_chunks(n, chunk_count(n, pool), pool, [&](std::size_t begin, std::size_t end, std::size_t) {
+    std::transform(first + begin, first + end, out + begin, f);
+  });
+  return out + n;
+}
+
+// Op must be associative: chunks are reduced independently and their
+// results combined in order.
+template <std::size_t Threshold = parallel_threshold,
+  class Iterator, class T, class ReduceOp, class TransformOp,
+  typename std::enable_if<!is_random_access_iterator<Iterator>::value>::type* = nullptr>
+T transform_reduce(Iterator first, Iterator last, T init, ReduceOp reduce, TransformOp transform,
+                   thread_pool& = thread_pool::instance()) {
+  for (; first != last; ++first) init = reduce(init, transform(*first));
+  return init;
+}
+
+template <std::size_t Threshold = parallel_threshold,
+  class Iterator, class T, class ReduceOp, class TransformOp,
+  typename std::enable_if<is_random_access_iterator<Iterator>::value>::type* = nullptr>
+T transform_reduce(Iterator first, Iterator last, T init, ReduceOp reduce, TransformOp transform,
+                   thread_pool& pool = thread_pool::instance()) {
+  const std::size_t n = last - first;
+  if (n < Threshold) {
+    for (; first != last; ++first) init = reduce(init, transform(*first));
+    return init;
+  }
+  const std::size_t chunks = chunk_count(n, pool);
+  std::vector<T> partial(chunks, init);
+  for_chunks(n, chunks, pool, [&](std::size_t begin, std::size_t end, std::size_t k) {
+    T sum = transform(first[begin]);
+    for (std::size_t i = begin + 1; i < end; ++i) sum = reduce(sum, transform(first[i]));
+    partial[k] = sum;
+  });
+  for (const T& sum : partial) init = reduce(init, sum);
+  return init;
+}
+
+// The pool follows the operation: reduce(first, last, init, std::plus<>(), pool).
+template <std::size_t Threshold = parallel_threshold, class Iterator, class T, class Op>
+T reduce(Iterator first, Iterator last, T init, Op op,
+         thread_pool& pool = thread_pool::instance()) {
+  return transform_reduce<Threshold>(first, last, init, op,
+      [](const iterator_value_t<Iterator>& v) -> const iterator_value_t<Iterator>& { return v; },
+      pool);
+}
+
+template <std::size_t Threshold = parallel_threshold, class Iterator, class T>
+T reduce(Iterator first, Iterator last, T init) {
+  return reduce<Threshold>(first, last, init, std::plus<>());
+}
+
+}  // namespace parallel
+
+TEST_F(SFINAE, ParallelAlgorithms) {
+  const std::size_t n = 100000;
+  std::vector<int64_t> v(n);
+  std::list<int64_t> ls;
+  for (std::size_t i = 0; i < n; ++i) {
+    v[i] = i;
+    ls.push_back(i);
+  }
+
+  parallel::for_each<1024>(v.begin(), v.end(), [](int64_t& x) { x *= 2; });
+  parallel::for_each<1024>(ls.begin(), ls.end(), [](int64_t& x) { x *= 2; });
+  EXPECT_EQ(2 * int64_t(n - 1), v.back());
+  EXPECT_TRUE(std::equal(v.begin(), v.end(), ls.begin()));
+
+  std::vector<double> halves(n);
+  EXPECT_EQ(halves.end(), parallel::transform<1024>(v.begin(), v.end(), halves.begin(),
+                                                    [](int64_t x) { return x / 2.0; }));
+  EXPECT_EQ(double(n - 1), halves.back());
+
+  const int64_t sum = int64_t(n) * (n - 1);
+  EXPECT_EQ(sum, parallel::reduce<1024>(v.begin(), v.end(), int64_t(0)));
+  EXPECT_EQ(sum, parallel::reduce<1024>(ls.begin(), ls.end(), int64_t(0)));
+  EXPECT_EQ(sum + 7, parallel::reduce(v.begin(), v.end(), int64_t(7)));
+  EXPECT_EQ(int64_t(n), parallel::transform_reduce<1024>(
+      v.begin(), v.end(), int64_t(0), std::plus<>(), [](int64_t) { return int64_t(1); }));
+
+  // Any pool can run the chunks instead of the shared one.
+  parallel::thread_pool pool(2);
+  EXPECT_EQ(sum, parallel::reduce<1024>(v.begin(), v.end(), int64_t(0), std::plus<>(), pool));
+  EXPECT_EQ(int64_t(n), parallel::transform_reduce<1024>(
+      v.begin(), v.end(), int64_t(0), std::plus<>(), [](int64_t) { return int64_t(1); }, pool));
+  parallel::for_each<1024>(v.begin(), v.end(), [](int64_t& x) { x /= 2; }, pool);
+  EXPECT_EQ(int64_t(n - 1), v.back());
+
+  // Order is kept for associative but non-commutative operations.
+  std::vector<std::string> letters;
+  for (std::size_t i = 0; i < 5000; ++i) letters.push_back(std::string(1, char('a' + i % 26)));
+  EXPECT_EQ(std::accumulate(letters.begin(), letters.end(), std::string(">")),
+            parallel::reduce<16>(letters.begin(), letters.end(), std::string(">")));
+
+  // Nested calls help the pool instead of waiting on it.
+  std::vector<std::vector<int>> rows(64, std::vector<int>(2048, 1));
+  parallel::for_each<1>(rows.begin(), rows.end(), [](std::vector<int>& row) {
+    parallel::for_each<1>(row.begin(), row.end(), [](int& x) { ++x; });
+  });
+  for (const auto& row : rows) EXPECT_EQ(2 * 2048, std::accumulate(row.begin(), row.end(), 0));
+
+  EXPECT_THROW(parallel::for_each<1>(v.begin(), v.end(), [](int64_t x) {
+    if (x == 1000) throw std::runtime_error("stop");
+  }), std::runtime_error);
+
+  static_assert(parallel::is_random_access_iterator<std::vector<int>::iterator>::value, "");
+  static_assert(!parallel::is_random_access_iterator<std::list<int>::iterator>::value, "");
+}
+
+TEST_F(SFINAE, WorkStealingPool) {
+  parallel::thread_pool pool(4);
+  std::atomic<int> done{0};
+  {
+    parallel::task_group group(pool);
+    for (int i = 0; i < 1000; ++i) {
+      group.run([&] { done.fetch_add(1, std::memory_order_relaxed); });
+    }
+    group.wait();
+  }
+  EXPECT_EQ(1000, done.load());
+  EXPECT_EQ(4u, pool.size());
+}
+
+// Records which overload ran. Each probed call site owns a slot in a
+// thread-local table, so recording is a few uncontended relaxed stores;
+// registry::snapshot() sums every live thread's table with the totals of the
+// threads that have exited.
+namespace instrument {
+
+const std::size_t max_call_sites = 256;
+
+struct counters {
+  uint64_t calls = 0;
+  uint64_t elements = 0;
+  uint64_t bytes = 0;
+  uint64_t cycles = 0;
+};
+
+struct call_site {
+  call_site(const char* function, const char* path, const char* file, int line);
+
+  const char* function;
+  const char* path;
+  const char* file;
+  int line;
+  std::size_t id;
+};
+
+class thread_counters;
+
+class registry {
+ public:
+  static registry& instance() {
+    static registry r;
+    return r;
+  }
+
+  std::size_t add(const call_site* site) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sites_.push_back(site);
+    retired_.emplace_back();
+    return sites_.size() - 1;
+  }
+
+  void attach(thread_counters* counters) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    threads_.push_back(counters);
+  }
+
+  void detach(thread_counters* counters);
+  std::vector<std::pair<const call_site*, counters>> snapshot();
+  void reset();
+  std::string to_json();
+
+ private:
+  std::mutex mutex_;
+  std::vector<const call_site*> sites_;
+  std::vector<thread_counters*> threads_;
+  std::vector<counters> retired_;
+};
+
+inline call_site::call_site(const char* function, const char* path, const char* file, int line)
+    : function(function), path(path), file(file), line(line),
+      id(registry::instance().add(this)) {}
+
+class thread_counters {
+ public:
+  static thread_counters& local() {
+    static thread_local thread_counters counters;
+    return counters;
+  }
+
+  // Only the owning thread writes, so a load and a store replace the
+  // read-modify-write; readers on other threads see consistent values.
+  void add(std::size_t id, uint64_t elements, uint64_t bytes, uint64_t cycles) {
+    if (id >= max_call_sites) return;
+    slot& s = slots_[id];
+    bump(s.calls, 1);
+    bump(s.elements, elements);
+    bump(s.bytes, bytes);
+    bump(s.cycles, cycles);
+  }
+
+  counters read(std::size_t id) const {
+    counters c;
+    if (id >= max_call_sites) return c;
+    const slot& s = slots_[id];
+    c.calls = s.calls.load(std::memory_order_relaxed);
+    c.elements = s.elements.load(std::memory_order_relaxed);
+    c.bytes = s.bytes.load(std::memory_order_relaxed);
+    c.cycles = s.cycles.load(std::memory_order_relaxed);
+    return c;
+  }
+
+  void clear() {
+    for (slot& s : slots_) {
+      s.calls.store(0, std::memory_order_relaxed);
+      s.elements.store(0, std::memory_order_relaxed);
+      s.bytes.store(0, std::memory_order_relaxed);
+      s.cycles.store(0, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  struct slot {
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> elements{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> cycles{0};
+  };
+
+  thread_counters() { registry::instance().attach(this); }
+  ~thread_counters() { registry::instance().detach(this); }
+
+  static void bump(std::atomic<uint64_t>& value, uint64_t delta) {
+    value.store(value.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+  }
+
+  std::array<slot, max_call_sites> slots_;
+};
+
+inline void add_to(counters& total, const counters& c) {
+  total.calls += c.calls;
+  total.elements += c.elements;
+  total.bytes += c.bytes;
+  total.cycles += c.cycles;
+}
+
+inline void registry::detach(thread_counters* counters) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (std::size_t id = 0; id < sites_.size(); ++id) add_to(retired_[id], counters->read(id));
+  threads_.erase(std::find(threads_.begin(), threads_.end(), counters));
+}
+
+inline std::vector<std::pair<const call_site*, counters>> registry::snapshot() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<std::pair<const call_site*, counters>> result;
+  for (std::size_t id = 0; id < sites_.size(); ++id) {
+    counters total = retired_[id];
+    for (thread_counters* t : threads_) add_to(total, t->read(id));
+    result.emplace_back(sites_[id], total);
+  }
+  return result;
 }
 
+// Counts recorded concurrently with a reset may survive it.
+inline void registry::reset() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (counters& c : retired_) c = counters();
+  for (thread_counters* t : threads_) t->clear();
+}
+
+inline std::string escape_json(const char* text) {
+  std::string result;
+  for (; *text != '\0'; ++text) {
+    const unsigned char c = *text;
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (c < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      result += buf;
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+inline std::string registry::to_json() {
+  std::ostringstream out;
+  out << "[";
+  const char* separator = "\n";
+  for (const auto& entry : snapshot()) {
+    const call_site& site = *entry.first;
+    const counters& c = entry.second;
+    out << separator << "  {\"function\": \"" << escape_json(site.function)
+        << "\", \"path\": \"" << escape_json(site.path)
+        << "\", \"file\": \"" << escape_json(site.file)
+        << "\", \"line\": " << site.line
+        << ", \"calls\": " << c.calls << ", \"elements\": " << c.elements
+        << ", \"bytes\": " << c.bytes << ", \"cycles\": " << c.cycles << "}";
+    separator = ",\n";
+  }
+  out << "\n]\n";
+  return out.str();
+}
+
+inline uint64_t timestamp() {
+#if SFINAE_INSTRUMENT >= 2 && (defined(__x86_64__) || defined(__i386__))
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Accumulates one call and records it when the overload returns.
+class probe {
+ public:
+  explicit probe(const call_site& site) : site_(site) {
+#if SFINAE_INSTRUMENT >= 2
+    start_ = timestamp();
+#endif
+  }
+
+  ~probe() {
+    uint64_t cycles = 0;
+#if SFINAE_INSTRUMENT >= 2
+    cycles = timestamp() - start_;
+#endif
+    thread_counters::local().add(site_.id, elements_, bytes_, cycles);
+  }
+
+  probe(const probe&) = delete;
+  probe& operator=(const probe&) = delete;
+
+  void count(uint64_t elements, uint64_t bytes) {
+    elements_ += elements;
+    bytes_ += bytes;
+  }
+
+ private:
+  const call_site& site_;
+  uint64_t elements_ = 0;
+  uint64_t bytes_ = 0;
+#if SFINAE_INSTRUMENT >= 2
+  uint64_t start_ = 0;
+#endif
+};
+
+}  // namespace instrument
+
+// SFINAE_PROBE(path) marks the overload it appears in as taken, and
+// SFINAE_PROBE_COUNT(elements, bytes) adds to that call's volume. Each
+// template instantiation is its own call site. Both expand to nothing, and
+// do not evaluate their arguments, when instrumentation is off.
+#if SFINAE_INSTRUMENT
+#if defined(__GNUC__)
+#define SFINAE_PROBE_FUNCTION __PRETTY_FUNCTION__
+#else
+#define SFINAE_PROBE_FUNCTION __func__
+#endif
+#define SFINAE_PROBE(path)                                                        \
+  static const ::sfinae::instrument::call_site sfinae_probe_site(                 \
+      SFINAE_PROBE_FUNCTION, path, __FILE__, __LINE__);                           \
+  ::sfinae::instrument::probe sfinae_probe(sfinae_probe_site)
+#define SFINAE_PROBE_COUNT(elements, bytes) sfinae_probe.count(elements, bytes)
+#else
+#define SFINAE_PROBE(path) static_cast<void>(0)
+#define SFINAE_PROBE_COUNT(elements, bytes) static_cast<void>(0)
+#endif
+
+// Iterators whose elements are adjacent in memory. Pointers qualify, and so
+// do the iterators of vector, string and array (array's are pointers).
+template <class Iterator, class = void>
+struct is_contiguous_iterator : std::is_pointer<Iterator> {};
+
+// Only a random-access iterator over an object type can be a vector or
+// string iterator. Checking that first keeps output iterators, whose
+// value_type is void, from instantiating vector<void>.
+template <class Iterator>
+struct is_contiguous_iterator<Iterator, typename std::enable_if<
+    !std::is_pointer<Iterator>::value &&
+    std::is_base_of<std::random_access_iterator_tag,
+                    typename std::iterator_traits<Iterator>::iterator_category>::value &&
+    std::is_object<iterator_value_t<Iterator>>::value &&
+    !std::is_array<iterator_value_t<Iterator>>::value &&
+    !std::is_abstract<iterator_value_t<Iterator>>::value &&
+    !std::is_same<iterator_value_t<Iterator>, bool>::value>::type>  // vector<bool> is packed.
+    : std::integral_constant<bool,
+        std::is_same<Iterator, typename std::vector<
+            typename std::iterator_traits<Iterator>::value_type>::iterator>::value ||
+        std::is_same<Iterator, typename std::vector<
+            typename std::iterator_traits<Iterator>::value_type>::const_iterator>::value ||
+        std::is_same<Iterator, std::string::iterator>::value ||
+        std::is_same<Iterator, std::string::const_iterator>::value> {};
+
+// Types whose objects may be moved to a new address with memcpy and the old
+// bytes then dropped without running a destructor. Specialize to opt in.
+template <class T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {};
+
+// Both ranges are contiguous and hold the same trivially copyable type, so a
+// range copy is a plain byte copy.
 template <class InputIterator, class OutputIterator>
-OutputIterator copy(InputIterator first, InputIterator last,
-                    OutputIterator out) {
-  std::cout << "loop copy" << std::endl;
+struct is_memcpyable : std::integral_constant<bool,
+    is_contiguous_iterator<InputIterator>::value &&
+    is_contiguous_iterator<OutputIterator>::value &&
+    std::is_same<iterator_value_t<InputIterator>, iterator_value_t<OutputIterator>>::value &&
+    std::is_trivially_copyable<iterator_value_t<InputIterator>>::value> {};
+
+template <class Iterator>
+auto to_address(Iterator it) -> decltype(&*it) {
+  return &*it;
+}
+
+// Above this size copies bypass the cache, since the destination would
+// evict everything else anyway.
+const std::size_t nontemporal_threshold = 4 * 1024 * 1024;
+
+// Not probed; the algorithm that calls it records the call, so that every
+// call is counted once.
+inline void copy_bytes(void* out, const void* first, std::size_t bytes) {
+#if defined(__SSE2__)
+  char* dst = static_cast<char*>(out);
+  const char* src = static_cast<const char*>(first);
+  const bool disjoint = dst + bytes <= src || src + bytes <= dst;
+  if (bytes >= nontemporal_threshold && disjoint) {
+    const std::size_t head = (16 - reinterpret_cast<std::uintptr_t>(dst) % 16) % 16;
+    std::memcpy(dst, src, head);
+    std::size_t i = head;
+    for (; i + 64 <= bytes; i += 64) {
+      const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+      const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 16));
+      const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 32));
+      const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i + 48));
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), a);
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 16), b);
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 32), c);
+      _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i + 48), d);
+    }
+    _mm_sfence();
+    std::memcpy(dst + i, src + i, bytes - i);
+    return;
+  }
+#endif
+  std::memmove(out, first, bytes);
+}
+
+template <class InputIterator, class OutputIterator,
+          typename std::enable_if<is_memcpyable<InputIterator, OutputIterator>::value>::type* = nullptr>
+OutputIterator copy(InputIterator first, InputIterator last, OutputIterator out) {
+  SFINAE_PROBE("memcpy");
+  const auto n = last - first;
+  if (n > 0) {
+    SFINAE_PROBE_COUNT(n, n * sizeof(iterator_value_t<InputIterator>));
+    copy_bytes(to_address(out), to_address(first), static_cast<std::size_t>(n) * sizeof(iterator_value_t<InputIterator>));
+  }
+  return out + n;
+}
+
+template <class InputIterator, class OutputIterator,
+          typename std::enable_if<!is_memcpyable<InputIterator, OutputIterator>::value>::type* = nullptr>
+OutputIterator copy(InputIterator first, InputIterator last, OutputIterator out) {
+  SFINAE_PROBE("loop");
   for (; first != last; ++out, ++first) {
     *out = *first;
+    SFINAE_PROBE_COUNT(1, sizeof(*first));
+  }
+  return out;
+}
+
+template <class InputIterator, class OutputIterator,
+          typename std::enable_if<is_memcpyable<InputIterator, OutputIterator>::value>::type* = nullptr>
+OutputIterator move(InputIterator first, InputIterator last, OutputIterator out) {
+  return sfinae::copy(first, last, out);
+}
+
+template <class InputIterator, class OutputIterator,
+          typename std::enable_if<!is_memcpyable<InputIterator, OutputIterator>::value>::type* = nullptr>
+OutputIterator move(InputIterator first, InputIterator last, OutputIterator out) {
+  SFINAE_PROBE("loop");
+  for (; first != last; ++out, ++first) {
+    *out = std::move(*first);
+    SFINAE_PROBE_COUNT(1, sizeof(*first));
+  }
+  return out;
+}
+
+template <class BidirectionalIterator1, class BidirectionalIterator2,
+          typename std::enable_if<
+              is_memcpyable<BidirectionalIterator1, BidirectionalIterator2>::value>::type* = nullptr>
+BidirectionalIterator2 copy_backward(BidirectionalIterator1 first, BidirectionalIterator1 last,
+                                     BidirectionalIterator2 out) {
+  SFINAE_PROBE("memmove");
+  const auto n = last - first;
+  if (n > 0) {
+    SFINAE_PROBE_COUNT(n, n * sizeof(iterator_value_t<BidirectionalIterator1>));
+    std::memmove(to_address(out - n), to_address(first),
+                 static_cast<std::size_t>(n) * sizeof(iterator_value_t<BidirectionalIterator1>));
+  }
+  return out - n;
+}
+
+template <class BidirectionalIterator1, class BidirectionalIterator2,
+          typename std::enable_if<
+              !is_memcpyable<BidirectionalIterator1, BidirectionalIterator2>::value>::type* = nullptr>
+BidirectionalIterator2 copy_backward(BidirectionalIterator1 first, BidirectionalIterator1 last,
+                                     BidirectionalIterator2 out) {
+  SFINAE_PROBE("loop");
+  while (first != last) {
+    *--out = *--last;
+    SFINAE_PROBE_COUNT(1, sizeof(*out));
   }
   return out;
 }
 
+// A value can be filled with memset if it is a single byte, or if all of its
+// bytes are zero.
+template <class T>
+bool is_byte_fillable(const T& value, unsigned char& byte) {
+  const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+  if (sizeof(T) == 1) {
+    byte = bytes[0];
+    return true;
+  }
+  for (std::size_t i = 0; i < sizeof(T); ++i) {
+    if (bytes[i] != 0) return false;
+  }
+  byte = 0;
+  return true;
+}
+
+template <class ForwardIterator, class T,
+          typename std::enable_if<
+              is_contiguous_iterator<ForwardIterator>::value &&
+              std::is_trivially_copyable<iterator_value_t<ForwardIterator>>::value &&
+              std::is_same<iterator_value_t<ForwardIterator>, T>::value>::type* = nullptr>
+void fill(ForwardIterator first, ForwardIterator last, const T& value) {
+  const auto n = last - first;
+  if (n <= 0) return;
+  unsigned char byte = 0;
+  if (is_byte_fillable(value, byte)) {
+    SFINAE_PROBE("memset");
+    SFINAE_PROBE_COUNT(n, n * sizeof(T));
+    std::memset(to_address(first), byte, static_cast<std::size_t>(n) * sizeof(T));
+    return;
+  }
+  SFINAE_PROBE("loop");
+  SFINAE_PROBE_COUNT(n, n * sizeof(T));
+  for (; first != last; ++first) {
+    *first = value;
+  }
+}
+
+template <class ForwardIterator, class T,
+          typename std::enable_if<
+              !(is_contiguous_iterator<ForwardIterator>::value &&
+                std::is_trivially_copyable<iterator_value_t<ForwardIterator>>::value &&
+                std::is_same<iterator_value_t<ForwardIterator>, T>::value)>::type* = nullptr>
+void fill(ForwardIterator first, ForwardIterator last, const T& value) {
+  SFINAE_PROBE("loop");
+  for (; first != last; ++first) {
+    *first = value;
+    SFINAE_PROBE_COUNT(1, sizeof(T));
+  }
+}
+
+// The destination of the uninitialized algorithms is raw storage for
+// value_type objects, given as a pointer.
+template <class InputIterator, class T,
+          typename std::enable_if<is_memcpyable<InputIterator, T*>::value>::type* = nullptr>
+T* uninitialized_copy(InputIterator first, InputIterator last, T* out) {
+  SFINAE_PROBE("memcpy");
+  const auto n = last - first;
+  SFINAE_PROBE_COUNT(n, n * sizeof(T));
+  if (n > 0) copy_bytes(out, to_address(first), static_cast<std::size_t>(n) * sizeof(T));
+  return out + n;
+}
+
+template <class InputIterator, class T,
+          typename std::enable_if<!is_memcpyable<InputIterator, T*>::value>::type* = nullptr>
+T* uninitialized_copy(InputIterator first, InputIterator last, T* out) {
+  SFINAE_PROBE("loop");
+  T* current = out;
+  try {
+    for (; first != last; ++first, ++current) {
+      new (static_cast<void*>(current)) T(*first);
+      SFINAE_PROBE_COUNT(1, sizeof(T));
+    }
+  } catch (...) {
+    for (; out != current; ++out) out->~T();
+    throw;
+  }
+  return current;
+}
+
+template <class InputIterator, class T,
+          typename std::enable_if<is_memcpyable<InputIterator, T*>::value>::type* = nullptr>
+T* uninitialized_move(InputIterator first, InputIterator last, T* out) {
+  return sfinae::uninitialized_copy(first, last, out);
+}
+
+template <class InputIterator, class T,
+          typename std::enable_if<!is_memcpyable<InputIterator, T*>::value>::type* = nullptr>
+T* uninitialized_move(InputIterator first, InputIterator last, T* out) {
+  SFINAE_PROBE("loop");
+  T* current = out;
+  try {
+    for (; first != last; ++first, ++current) {
+      new (static_cast<void*>(current)) T(std::move(*first));
+      SFINAE_PROBE_COUNT(1, sizeof(T));
+    }
+  } catch (...) {
+    for (; out != current; ++out) out->~T();
+    throw;
+  }
+  return current;
+}
+
+// Moves [first, last) into raw storage and ends the lifetime of the source
+// objects, as a container does when it grows.
+template <class T,
+          typename std::enable_if<is_trivially_relocatable<T>::value>::type* = nullptr>
+T* uninitialized_relocate(T* first, T* last, T* out) {
+  SFINAE_PROBE("memcpy");
+  const std::size_t n = last - first;
+  SFINAE_PROBE_COUNT(n, n * sizeof(T));
+  if (n > 0) copy_bytes(out, first, n * sizeof(T));
+  return out + n;
+}
+
+template <class T,
+          typename std::enable_if<!is_trivially_relocatable<T>::value>::type* = nullptr>
+T* uninitialized_relocate(T* first, T* last, T* out) {
+  // Recorded by uninitialized_move.
+  T* result = sfinae::uninitialized_move(first, last, out);
+  for (; first != last; ++first) first->~T();
+  return result;
+}
+
 TEST_F(SFINAE, CopyOptimization) {
   int ar1[3] = {3, 1, 4};
   int ar2[3] = {};
@@ -179,47 +1478,397 @@ TEST_F(SFINAE, CopyOptimization) {
   EXPECT_EQ(ls1, ls2);
 }
 
+TEST_F(SFINAE, ContiguousIterator) {
+  static_assert(is_contiguous_iterator<int*>::value, "pointer");
+  static_assert(is_contiguous_iterator<std::vector<int>::iterator>::value, "vector");
+  static_assert(is_contiguous_iterator<std::vector<int>::const_iterator>::value, "vector");
+  static_assert(is_contiguous_iterator<std::string::iterator>::value, "string");
+  static_assert(is_contiguous_iterator<std::array<int, 3>::iterator>::value, "array");
+  static_assert(!is_contiguous_iterator<std::list<int>::iterator>::value, "list");
+  static_assert(!is_contiguous_iterator<std::vector<bool>::iterator>::value, "vector<bool>");
+  static_assert(!is_contiguous_iterator<std::back_insert_iterator<std::vector<int>>>::value,
+                "output iterator");
+  static_assert(!is_contiguous_iterator<std::ostream_iterator<int>>::value, "output iterator");
+
+  static_assert(is_memcpyable<std::vector<int>::const_iterator, int*>::value, "trivial");
+  static_assert(!is_memcpyable<std::vector<std::string>::iterator, std::string*>::value,
+                "not trivially copyable");
+  static_assert(!is_memcpyable<std::vector<int>::iterator, long*>::value, "converting");
+}
+
+TEST_F(SFINAE, CopyFamily) {
+  std::vector<int> v = {1, 2, 3, 4, 5};
+  std::vector<int> w(5);
+  EXPECT_EQ(w.end(), sfinae::copy(v.cbegin(), v.cend(), w.begin()));
+  EXPECT_EQ(v, w);
+
+  // Overlapping ranges in both directions.
+  sfinae::copy_backward(v.begin(), v.begin() + 3, v.begin() + 5);
+  EXPECT_EQ((std::vector<int>{1, 2, 1, 2, 3}), v);
+  sfinae::move(v.begin() + 2, v.end(), v.begin());
+  EXPECT_EQ((std::vector<int>{1, 2, 3, 2, 3}), v);
+
+  std::vector<std::string> strings = {"a", "b"};
+  std::vector<std::string> moved(2);
+  sfinae::move(strings.begin(), strings.end(), moved.begin());
+  EXPECT_EQ((std::vector<std::string>{"a", "b"}), moved);
+
+  // Output iterators have no value_type and take the loop.
+  std::vector<int> appended;
+  sfinae::copy(v.begin(), v.end(), std::back_inserter(appended));
+  EXPECT_EQ(v, appended);
+  std::ostringstream os;
+  sfinae::copy(v.begin(), v.end(), std::ostream_iterator<int>(os, ","));
+  EXPECT_EQ("1,2,3,2,3,", os.str());
+
+  std::string text(8, 'x');
+  sfinae::fill(text.begin(), text.end(), 'y');
+  EXPECT_EQ("yyyyyyyy", text);
+  std::vector<double> zeros(4, 1.0);
+  sfinae::fill(zeros.begin(), zeros.end(), 0.0);
+  EXPECT_EQ(std::vector<double>(4, 0.0), zeros);
+  sfinae::fill(zeros.begin(), zeros.end(), 2.5);
+  EXPECT_EQ(std::vector<double>(4, 2.5), zeros);
+
+  std::allocator<std::string> alloc;
+  std::string* raw = alloc.allocate(2);
+  std::string* end = sfinae::uninitialized_copy(moved.begin(), moved.end(), raw);
+  EXPECT_EQ(raw + 2, end);
+  EXPECT_EQ("b", raw[1]);
+  std::string* relocated = alloc.allocate(2);
+  sfinae::uninitialized_relocate(raw, end, relocated);
+  EXPECT_EQ("a", relocated[0]);
+  relocated[0].~basic_string();
+  relocated[1].~basic_string();
+  alloc.deallocate(relocated, 2);
+  alloc.deallocate(raw, 2);
+}
+
+TEST_F(SFINAE, LargeCopy) {
+  // Large enough to take the non-temporal path.
+  std::vector<uint8_t> src(nontemporal_threshold + 123);
+  for (std::size_t i = 0; i < src.size(); ++i) src[i] = static_cast<uint8_t>(i * 7);
+  std::vector<uint8_t> dst(src.size() + 1);
+  sfinae::copy(src.begin(), src.end(), dst.begin() + 1);
+  EXPECT_TRUE(std::equal(src.begin(), src.end(), dst.begin() + 1));
+}
+
 namespace destroy {
 template <class T,
           typename std::enable_if<std::is_trivially_destructible<T>::value>::type* = nullptr>
-void destroy_all(T*, T*) {
-  std::cout << "don't destroy" << std::endl;
+void destroy_all(T* first, T* last) {
+  SFINAE_PROBE("trivial");
+  SFINAE_PROBE_COUNT(last - first, 0);
+  static_cast<void>(first);
+  static_cast<void>(last);
 }
 
 template <class T,
           typename std::enable_if<!std::is_trivially_destructible<T>::value>::type* = nullptr>
 void destroy_all(T* first, T* last) {
-  std::cout << "loop destroy" << std::endl;
+  SFINAE_PROBE("loop");
+  SFINAE_PROBE_COUNT(last - first, (last - first) * sizeof(T));
   while (first != last) {
     first->~T();
     ++first;
   }
 }
 
+// Types whose value-initialized state is all zero bytes. Member pointers
+// are excluded because a null one is not zero on common ABIs; specialize to
+// opt in a trivial class that contains none.
 template <class T>
+struct is_zero_initializable : std::integral_constant<bool,
+    std::is_arithmetic<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value> {};
+
+template <class T,
+          typename std::enable_if<is_zero_initializable<T>::value>::type* = nullptr>
 void construct_all(T* first, T* last) {
-  while (first != last) {
-    new (first) T();
-    ++first;
+  SFINAE_PROBE("memset");
+  SFINAE_PROBE_COUNT(last - first, (last - first) * sizeof(T));
+  if (first != last) std::memset(first, 0, (last - first) * sizeof(T));
+}
+
+// Constructs every element or none: if a constructor throws, the elements
+// already built are destroyed before the exception propagates.
+template <class T,
+          typename std::enable_if<!is_zero_initializable<T>::value>::type* = nullptr>
+void construct_all(T* first, T* last) {
+  SFINAE_PROBE("loop");
+  SFINAE_PROBE_COUNT(last - first, (last - first) * sizeof(T));
+  T* current = first;
+  try {
+    while (current != last) {
+      new (current) T();
+      ++current;
+    }
+  } catch (...) {
+    destroy_all(first, current);
+    throw;
   }
 }
 
+// Slab allocator for arrays of T. Requests are rounded up to a power of two
+// and served from a free list per size; slabs are only returned to the
+// system when the pool is destroyed, so steady-state allocation never calls
+// operator new. A pool is not thread-safe; local() gives each thread its own.
+// Blocks must go back to the pool they came from, on the thread that owns
+// it: a block freed into another thread's local() pool would dangle once the
+// first thread exits. Debug builds assert both.
+template <class T>
+class object_pool {
+ public:
+    static const std::size_t slab_size = 256;  // In units of one T.
+
+    object_pool() = default;
+    object_pool(const object_pool&) = delete;
+    object_pool& operator=(const object_pool&) = delete;
+
+    ~object_pool() {
+      while (slabs_ != nullptr) {
+        slab* next = slabs_->next;
+        ::operator delete(slabs_);
+        slabs_ = next;
+      }
+    }
+
+    static object_pool& local() {
+      static thread_local object_pool pool;
+      return pool;
+    }
+
+    T* allocate(std::size_t n) {
+      assert(owner_ == std::this_thread::get_id());
+      if (n > slab_size) return static_cast<T*>(::operator new(n * sizeof(unit)));
+      const std::size_t size_class = class_of(n);
+      if (free_[size_class] != nullptr) {
+        free_node* node = free_[size_class];
+        free_[size_class] = node->next;
+        return reinterpret_cast<T*>(node);
+      }
+      const std::size_t units = std::size_t(1) << size_class;
+      if (slabs_ == nullptr || used_ + units > slab_size) add_slab();
+      T* result = reinterpret_cast<T*>(slabs_->units + used_);
+      used_ += units;
+      return result;
+    }
+
+    void deallocate(T* p, std::size_t n) {
+      assert(owner_ == std::this_thread::get_id());
+      if (n > slab_size) {
+        ::operator delete(p);
+        return;
+      }
+      assert(owns(p));
+      const std::size_t size_class = class_of(n);
+      free_node* node = reinterpret_cast<free_node*>(p);
+      node->next = free_[size_class];
+      free_[size_class] = node;
+    }
+
+    template <class... Args>
+    T* create(Args&&... args) {
+      T* p = allocate(1);
+      try {
+        return new (p) T(std::forward<Args>(args)...);
+      } catch (...) {
+        deallocate(p, 1);
+        throw;
+      }
+    }
+
+    void destroy(T* p) {
+      destroy_all(p, p + 1);
+      deallocate(p, 1);
+    }
+
+    // Value-initializes n objects; a memset for zero-initializable types.
+    T* create_n(std::size_t n) {
+      T* p = allocate(n);
+      try {
+        construct_all(p, p + n);
+      } catch (...) {
+        deallocate(p, n);
+        throw;
+      }
+      return p;
+    }
+
+    // Destroys n objects; no destructor runs for trivially destructible types.
+    void destroy_n(T* p, std::size_t n) {
+      destroy_all(p, p + n);
+      deallocate(p, n);
+    }
+
+ private:
+    struct free_node {
+      free_node* next;
+    };
+
+    union unit {
+      free_node node;
+      typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+    // Slabs come from operator new, which only aligns to max_align_t.
+    static_assert(alignof(unit) <= alignof(std::max_align_t), "over-aligned types are not supported");
+
+    struct slab {
+      slab* next;
+      unit units[slab_size];
+    };
+
+    static std::size_t class_of(std::size_t n) {
+      std::size_t size_class = 0;
+      while ((std::size_t(1) << size_class) < n) ++size_class;
+      return size_class;
+    }
+
+    bool owns(const T* p) const {
+      const unit* u = reinterpret_cast<const unit*>(p);
+      for (const slab* s = slabs_; s != nullptr; s = s->next) {
+        if (u >= s->units && u < s->units + slab_size) return true;
+      }
+      return false;
+    }
+
+    void add_slab() {
+      slab* fresh = static_cast<slab*>(::operator new(sizeof(slab)));
+      fresh->next = slabs_;
+      slabs_ = fresh;
+      used_ = 0;
+    }
+
+    static const std::size_t class_count = 9;  // 1, 2, 4, ..., slab_size units.
+
+    slab* slabs_ = nullptr;
+    std::size_t used_ = 0;
+    free_node* free_[class_count] = {};
+    std::thread::id owner_ = std::this_thread::get_id();
+};
+
 template <class T>
 void f() {
-  std::allocator<T> alloc;
+  object_pool<T>& pool = object_pool<T>::local();
 
   std::size_t size = 3;
-  T* ar = alloc.allocate(size, nullptr);
+  T* ar = pool.allocate(size);
   construct_all(ar, ar + size);
 
   destroy_all(ar, ar + size);
-  alloc.deallocate(ar, size);
+  pool.deallocate(ar, size);
 }
+
+struct counted {
+  static int live;
+  static int throw_after;
+
+  counted() {
+    if (throw_after-- == 0) throw std::runtime_error("construction failed");
+    ++live;
+  }
+  ~counted() { --live; }
+};
+
+int counted::live = 0;
+int counted::throw_after = -1;
 }
 
+TEST_F(SFINAE, ObjectPool) {
+  destroy::object_pool<std::string> strings;
+  std::string* s = strings.create("pooled");
+  EXPECT_EQ("pooled", *s);
+  strings.destroy(s);
+  EXPECT_EQ(s, strings.create());  // Reused from the free list.
+
+  destroy::object_pool<int> ints;
+  int* xs = ints.create_n(100);
+  EXPECT_EQ(std::vector<int>(100, 0), std::vector<int>(xs, xs + 100));
+  ints.destroy_n(xs, 100);
+  EXPECT_EQ(xs, ints.allocate(128));  // Same size class.
+  int* big = ints.create_n(1000);  // Larger than a slab.
+  ints.destroy_n(big, 1000);
+
+  destroy::counted::throw_after = 5;
+  destroy::object_pool<destroy::counted> counters;
+  EXPECT_THROW(counters.create_n(10), std::runtime_error);
+  EXPECT_EQ(0, destroy::counted::live);
+
+  destroy::object_pool<int>* main_pool = &destroy::object_pool<int>::local();
+  destroy::object_pool<int>* other_pool = nullptr;
+  std::thread([&] { other_pool = &destroy::object_pool<int>::local(); }).join();
+  EXPECT_NE(main_pool, other_pool);
+}
+
+#ifndef NDEBUG
+TEST_F(SFINAE, ObjectPoolWrongOwner) {
+  // The thread pool of the parallel tests is running, so fork() is unsafe.
+  GTEST_FLAG_SET(death_test_style, "threadsafe");
+  destroy::object_pool<int> first;
+  destroy::object_pool<int> second;
+  int* x = first.allocate(1);
+  EXPECT_DEATH(second.deallocate(x, 1), "owns");
+  EXPECT_DEATH(std::thread([&] { first.deallocate(x, 1); }).join(), "owner_");
+  first.deallocate(x, 1);
+}
+#endif
+
 TEST_F(SFINAE, DestroyAll) {
   destroy::f<std::string>();
   destroy::f<int>();
 }
 
+TEST_F(SFINAE, Instrumentation) {
+  instrument::registry::instance().reset();
+  std::string strings[3];
+  int ints[4] = {};
+  destroy::destroy_all(std::begin(ints), std::end(ints));
+  std::thread([] {
+    std::string other[2];
+    destroy::destroy_all(std::begin(other), std::end(other));
+    new (&other[0]) std::string();
+    new (&other[1]) std::string();
+  }).join();
+  destroy::destroy_all(std::begin(strings), std::end(strings));
+  for (auto& s : strings) new (&s) std::string();
+
+  instrument::counters trivial;
+  instrument::counters loop;
+  for (const auto& entry : instrument::registry::instance().snapshot()) {
+    const std::string function = entry.first->function;
+    if (function.find("destroy_all") == std::string::npos) continue;
+    if (std::string(entry.first->path) == "trivial") instrument::add_to(trivial, entry.second);
+    if (std::string(entry.first->path) == "loop") instrument::add_to(loop, entry.second);
+  }
+  const std::string json = instrument::registry::instance().to_json();
+  EXPECT_EQ('[', json.front());
+#if SFINAE_INSTRUMENT
+  EXPECT_EQ(1u, trivial.calls);
+  EXPECT_EQ(4u, trivial.elements);
+  EXPECT_EQ(2u, loop.calls);  // One of them on a thread that has exited.
+  EXPECT_EQ(5u, loop.elements);
+  EXPECT_EQ(5 * sizeof(std::string), loop.bytes);
+  EXPECT_NE(std::string::npos, json.find("\"path\": \"loop\""));
+#else
+  EXPECT_EQ(0u, trivial.calls + loop.calls);
+  EXPECT_EQ("[\n]\n", json);
+#endif
+
+  // A call that passes through helpers is still counted once.
+  instrument::registry::instance().reset();
+  const std::vector<int> from(8, 1);
+  std::vector<int> to(8);
+  sfinae::copy(from.begin(), from.end(), to.begin());
+  instrument::counters all;
+  for (const auto& entry : instrument::registry::instance().snapshot()) {
+    instrument::add_to(all, entry.second);
+  }
+#if SFINAE_INSTRUMENT
+  EXPECT_EQ(1u, all.calls);
+  EXPECT_EQ(8u, all.elements);
+  EXPECT_EQ(8 * sizeof(int), all.bytes);
+#else
+  EXPECT_EQ(0u, all.calls);
+#endif
+}
+
 }  // namespace sfinae
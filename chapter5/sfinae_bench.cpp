@@ -0,0 +1,308 @@
+// Copyright <2018> <Tomoyuki Nakabayashi>
+// This software is released under the Apache 2.0 License, see LICENSE.
+
+// Runtime benchmarks for the SFINAE-dispatched algorithms. The code under
+// test is the test source itself; its tests are compiled in but not run.
+
+#include "sfinae.cpp"
+
+namespace bench {
+
+// Keeps the compiler from discarding a result nobody reads.
+template <typename T>
+void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Best time per call of f over a few rounds of at least 20 ms each.
+template <typename F>
+double ns_per_call(F&& f) {
+  typedef std::chrono::steady_clock clock;
+  std::size_t calls = 1;
+  double best = 0;
+  for (int round = 0; round < 5;) {
+    const auto start = clock::now();
+    for (std::size_t i = 0; i < calls; ++i) f();
+    const double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    if (ns < 20e6) {
+      calls *= 2;
+      continue;
+    }
+    if (round == 0 || ns / calls < best) best = ns / calls;
+    ++round;
+  }
+  return best;
+}
+
+void report(const char* name, std::size_t n, double ns) {
+  std::printf("%-40s %10zu %12.1f ns\n", name, n, ns);
+}
+
+}  // namespace bench
+
+namespace sfinae {
+
+// The element loop every non-pointer range used to take. GCC would turn it
+// into a memmove call at -O2, which is the very change being measured.
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+#endif
+int* loop_copy(const int* first, const int* last, int* out) {
+  for (; first != last; ++out, ++first) *out = *first;
+  return out;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("no-tree-loop-distribute-patterns")))
+#endif
+void loop_fill(int* first, int* last, int value) {
+  for (; first != last; ++first) *first = value;
+}
+
+// The largest size is above nontemporal_threshold.
+void bench_copy() {
+  for (std::size_t n : {64, 4096, 1 << 18, 1 << 22}) {
+    const std::vector<int> src(n, 1);
+    std::vector<int> dst(n);
+    bench::report("copy/element loop", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(loop_copy(src.data(), src.data() + n, dst.data()));
+    }));
+    bench::report("copy/vector iterators", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(sfinae::copy(src.begin(), src.end(), dst.begin()));
+    }));
+    bench::report("copy_backward/vector iterators", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(sfinae::copy_backward(src.begin(), src.end(), dst.end()));
+    }));
+    bench::report("fill/element loop", n, bench::ns_per_call([&] {
+      loop_fill(dst.data(), dst.data() + n, 0);
+      bench::do_not_optimize(dst.data());
+    }));
+    bench::report("fill/vector iterators", n, bench::ns_per_call([&] {
+      sfinae::fill(dst.begin(), dst.end(), 0);
+      bench::do_not_optimize(dst.data());
+    }));
+    std::allocator<int> alloc;
+    int* raw = alloc.allocate(n);
+    bench::report("uninitialized_copy/vector iterators", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(sfinae::uninitialized_copy(src.begin(), src.end(), raw));
+    }));
+    alloc.deallocate(raw, n);
+  }
+}
+
+namespace expression {
+
+// Operator overloading without expression templates: every operator
+// allocates and fills a temporary.
+typedef std::vector<double> naive_array;
+
+naive_array operator+(const naive_array& a, const naive_array& b) {
+  naive_array r(a.size());
+  for (std::size_t i = 0; i < a.size(); ++i) r[i] = a[i] + b[i];
+  return r;
+}
+
+naive_array operator*(const naive_array& a, const naive_array& b) {
+  naive_array r(a.size());
+  for (std::size_t i = 0; i < a.size(); ++i) r[i] = a[i] * b[i];
+  return r;
+}
+
+// r = a + b + c * d, evaluated into an existing result.
+void bench_formula() {
+  for (std::size_t n : {1000, 1 << 16, 1 << 22}) {
+    const naive_array na(n, 1.0), nb(n, 2.0), nc(n, 3.0), nd(n, 4.0);
+    naive_array nr(n);
+    bench::report("a+b+c*d/temporary per operator", n, bench::ns_per_call([&] {
+      nr = na + nb + nc * nd;
+      bench::do_not_optimize(nr.data());
+    }));
+    bench::report("a+b+c*d/hand-written loop", n, bench::ns_per_call([&] {
+      for (std::size_t i = 0; i < n; ++i) nr[i] = na[i] + nb[i] + nc[i] * nd[i];
+      bench::do_not_optimize(nr.data());
+    }));
+    const array<double> a(n, 1.0), b(n, 2.0), c(n, 3.0), d(n, 4.0);
+    array<double> r(n);
+    bench::report("a+b+c*d/expression template", n, bench::ns_per_call([&] {
+      r = a + b + c * d;
+      bench::do_not_optimize(r.data());
+    }));
+  }
+}
+
+}  // namespace expression
+
+namespace parallel {
+
+// parallel::reduce and transform_reduce over 2^22 doubles on pools of 1, 2,
+// 4, ... workers up to the hardware, next to the serial loops.
+void bench_scaling() {
+  const std::size_t n = 1 << 22;
+  const std::vector<double> values(n, 1.5);
+  bench::report("sum/std::accumulate", n, bench::ns_per_call([&] {
+    bench::do_not_optimize(std::accumulate(values.begin(), values.end(), 0.0));
+  }));
+  bench::report("sum of squares/std::inner_product", n, bench::ns_per_call([&] {
+    bench::do_not_optimize(
+        std::inner_product(values.begin(), values.end(), values.begin(), 0.0));
+  }));
+  const std::size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t workers = 1;; workers = std::min(2 * workers, hardware)) {
+    thread_pool pool(workers);
+    char name[64];
+    std::snprintf(name, sizeof(name), "sum/parallel::reduce %zu workers", workers);
+    bench::report(name, n, bench::ns_per_call([&] {
+      bench::do_not_optimize(
+          parallel::reduce(values.begin(), values.end(), 0.0, std::plus<>(), pool));
+    }));
+    std::snprintf(name, sizeof(name), "sum of squares/transform_reduce %zu workers", workers);
+    bench::report(name, n, bench::ns_per_call([&] {
+      bench::do_not_optimize(parallel::transform_reduce(
+          values.begin(), values.end(), 0.0, std::plus<>(), [](double x) { return x * x; },
+          pool));
+    }));
+    if (workers == hardware) break;
+  }
+}
+
+// Small inputs: below the threshold reduce is the serial loop; forcing a
+// threshold of 1 shows what a trip through the pool costs.
+void bench_overhead() {
+  for (std::size_t n : {100, 1000, 10000}) {
+    const std::vector<double> values(n, 1.5);
+    bench::report("reduce small/std::accumulate", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(std::accumulate(values.begin(), values.end(), 0.0));
+    }));
+    bench::report("reduce small/parallel::reduce", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(parallel::reduce(values.begin(), values.end(), 0.0));
+    }));
+    bench::report("reduce small/parallel::reduce<1>", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(parallel::reduce<1>(values.begin(), values.end(), 0.0));
+    }));
+  }
+}
+
+}  // namespace parallel
+
+// Keys for the sort matrix: uniformly random, already sorted, and drawn
+// from only 16 distinct values.
+template <class T>
+std::vector<T> sort_input(std::size_t n, const char* distribution) {
+  std::vector<T> values(n);
+  uint64_t seed = n;
+  for (std::size_t i = 0; i < n; ++i) {
+    seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+    const int64_t bits = static_cast<int64_t>(seed >> 16);
+    if (std::strcmp(distribution, "sorted") == 0) {
+      values[i] = static_cast<T>(i);
+    } else if (std::strcmp(distribution, "16 values") == 0) {
+      values[i] = static_cast<T>(bits % 16);
+    } else {
+      values[i] = static_cast<T>(bits % 2000001 - 1000000) / static_cast<T>(bits % 7 + 1);
+    }
+  }
+  return values;
+}
+
+// Both sides include copying the input into the buffer that is sorted.
+template <class T>
+void bench_sort(const char* type) {
+  for (const char* distribution : {"random", "sorted", "16 values"}) {
+    for (std::size_t n : {16, 1000, 1 << 20}) {
+      const std::vector<T> input = sort_input<T>(n, distribution);
+      std::vector<T> buffer(n);
+      char name[64];
+      std::snprintf(name, sizeof(name), "std::sort %s %s", type, distribution);
+      bench::report(name, n, bench::ns_per_call([&] {
+        std::copy(input.begin(), input.end(), buffer.begin());
+        std::sort(buffer.begin(), buffer.end());
+        bench::do_not_optimize(buffer.data());
+      }));
+      std::snprintf(name, sizeof(name), "sfinae::sort %s %s", type, distribution);
+      bench::report(name, n, bench::ns_per_call([&] {
+        std::copy(input.begin(), input.end(), buffer.begin());
+        sfinae::sort(buffer);
+        bench::do_not_optimize(buffer.data());
+      }));
+      if (n < sort_thresholds<>::parallel) continue;
+      // The path comparison sorts take at this size, whatever the key.
+      std::snprintf(name, sizeof(name), "parallel_sort %s %s", type, distribution);
+      bench::report(name, n, bench::ns_per_call([&] {
+        std::copy(input.begin(), input.end(), buffer.begin());
+        sfinae::parallel_sort(buffer.begin(), buffer.end());
+        bench::do_not_optimize(buffer.data());
+      }));
+    }
+  }
+}
+
+namespace destroy {
+
+struct particle {
+  particle() : x(0), y(0), z(0), mass(1) {}
+  double x, y, z, mass;
+};
+
+// A batch of single objects created and then destroyed, and one array of n
+// value-initialized doubles.
+void bench_pool() {
+  const std::size_t batch = 64;
+  std::vector<particle*> live(batch);
+  bench::report("create+destroy particle/new,delete", batch, bench::ns_per_call([&] {
+    for (auto& p : live) p = new particle();
+    bench::do_not_optimize(live.data());
+    for (auto p : live) delete p;
+  }));
+  std::allocator<particle> alloc;
+  bench::report("create+destroy particle/std::allocator", batch, bench::ns_per_call([&] {
+    for (auto& p : live) p = new (alloc.allocate(1)) particle();
+    bench::do_not_optimize(live.data());
+    for (auto p : live) {
+      p->~particle();
+      alloc.deallocate(p, 1);
+    }
+  }));
+  object_pool<particle>& particles = object_pool<particle>::local();
+  bench::report("create+destroy particle/object_pool", batch, bench::ns_per_call([&] {
+    for (auto& p : live) p = particles.create();
+    bench::do_not_optimize(live.data());
+    for (auto p : live) particles.destroy(p);
+  }));
+
+  object_pool<double>& doubles = object_pool<double>::local();
+  for (std::size_t n : {16, 256}) {
+    bench::report("create_n double/new[]", n, bench::ns_per_call([&] {
+      double* p = new double[n]();
+      bench::do_not_optimize(p);
+      delete[] p;
+    }));
+    std::allocator<double> double_alloc;
+    bench::report("create_n double/std::allocator", n, bench::ns_per_call([&] {
+      double* p = double_alloc.allocate(n);
+      for (std::size_t i = 0; i < n; ++i) new (p + i) double();
+      bench::do_not_optimize(p);
+      double_alloc.deallocate(p, n);
+    }));
+    bench::report("create_n double/object_pool", n, bench::ns_per_call([&] {
+      double* p = doubles.create_n(n);
+      bench::do_not_optimize(p);
+      doubles.destroy_n(p, n);
+    }));
+  }
+}
+
+}  // namespace destroy
+}  // namespace sfinae
+
+int main() {
+  std::printf("%-40s %10s %15s\n", "benchmark", "n", "time/call");
+  sfinae::bench_copy();
+  sfinae::destroy::bench_pool();
+  sfinae::bench_sort<int32_t>("int32");
+  sfinae::bench_sort<uint64_t>("uint64");
+  sfinae::bench_sort<double>("double");
+  sfinae::expression::bench_formula();
+  sfinae::parallel::bench_scaling();
+  sfinae::parallel::bench_overhead();
+  return 0;
+}
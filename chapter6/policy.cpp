@@ -1,8 +1,34 @@
 // Copyright <2018> <Tomoyuki Nakabayashi>
 // This software is released under the Apache 2.0 License, see LICENSE.
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iomanip>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 #include <gtest/gtest.h>
 
 
@@ -21,6 +47,399 @@ struct release_log {
   static void print(const std::string&) {}
 };
 
+enum class level : uint32_t { debug, info, warning, error, fatal };
+
+inline const char* level_name(level l) {
+  static const char* const names[] = {"DEBUG", "INFO", "WARNING", "ERROR", "FATAL"};
+  return names[static_cast<uint32_t>(l)];
+}
+
+// How arguments are stored in a log record and printed from it later.
+// Numbers are copied as they are; strings as a length and their bytes.
+// String bytes are the only part of a record that can be cut: write() takes
+// at most budget of them and subtracts what it took.
+template <class T, class = void>
+struct log_argument {
+  static_assert(std::is_arithmetic<T>::value, "log arguments are numbers or strings");
+  static const bool fixed_size = true;
+  static std::size_t size(const T&) { return sizeof(T); }
+  static std::size_t text_size(const T&) { return 0; }
+  static char* write(char* out, const T& value, std::size_t&) {
+    std::memcpy(out, &value, sizeof(T));
+    return out + sizeof(T);
+  }
+  static const char* read(const char* in, std::ostream& out) {
+    T value;
+    std::memcpy(&value, in, sizeof(T));
+    out << value;
+    return in + sizeof(T);
+  }
+};
+
+struct log_string {
+  static const bool fixed_size = false;
+  static std::size_t size(const char* value, std::size_t length) {
+    static_cast<void>(value);
+    return sizeof(uint32_t) + length;
+  }
+  static char* write(char* out, const char* value, std::size_t length, std::size_t& budget) {
+    const uint32_t n = static_cast<uint32_t>(std::min(length, budget));
+    budget -= n;
+    std::memcpy(out, &n, sizeof(n));
+    std::memcpy(out + sizeof(n), value, n);
+    return out + sizeof(n) + n;
+  }
+  static const char* read(const char* in, std::ostream& out) {
+    uint32_t n;
+    std::memcpy(&n, in, sizeof(n));
+    out.write(in + sizeof(n), n);
+    return in + sizeof(n) + n;
+  }
+};
+
+template <>
+struct log_argument<std::string> : log_string {
+  static std::size_t size(const std::string& value) { return log_string::size(value.data(), value.size()); }
+  static std::size_t text_size(const std::string& value) { return value.size(); }
+  static char* write(char* out, const std::string& value, std::size_t& budget) {
+    return log_string::write(out, value.data(), value.size(), budget);
+  }
+};
+
+template <>
+struct log_argument<const char*> : log_string {
+  static std::size_t size(const char* value) { return log_string::size(value, std::strlen(value)); }
+  static std::size_t text_size(const char* value) { return std::strlen(value); }
+  static char* write(char* out, const char* value, std::size_t& budget) {
+    return log_string::write(out, value, std::strlen(value), budget);
+  }
+};
+
+template <>
+struct log_argument<char*> : log_argument<const char*> {};
+
+template <std::size_t N>
+struct log_argument<char[N]> : log_argument<const char*> {};
+
+// A record is this header followed by the encoded arguments, padded to a
+// multiple of eight bytes. Formatting happens on the writer thread.
+struct log_record {
+  typedef void (*format_function)(std::ostream&, const char*);
+  static const uint32_t padding = ~0u;  // level of the filler at the end of the ring.
+  static const uint32_t truncated = 1u << 31;  // level flag: strings were cut to fit.
+
+  uint32_t size;
+  uint32_t level;
+  format_function format;
+  int64_t time_ns;
+};
+
+template <class... Args>
+void format_record(std::ostream& out, const char* payload) {
+  const int expand[] = {0, (payload = log_argument<Args>::read(payload, out), 0)...};
+  static_cast<void>(expand);
+  static_cast<void>(payload);
+}
+
+// Single-producer single-consumer ring of variable-length records. The
+// producer is the logging thread, the consumer the writer thread.
+class log_ring {
+ public:
+  enum push_result { full, pushed, pushed_into_empty };
+
+  explicit log_ring(std::size_t capacity)
+      : capacity_(capacity), mask_(capacity - 1), buffer_(new uint64_t[capacity / 8]) {
+    assert(capacity >= 64 && (capacity & mask_) == 0);
+  }
+
+  // Copies a record of the given size, a multiple of eight, into the ring if
+  // there is room for it. A record that would cross the end of the buffer
+  // goes to the start, after a filler. Reports whether the consumer had
+  // already taken everything before this record, so that it may be asleep.
+  template <class Write>
+  push_result try_push(std::size_t bytes, Write write) {
+    const uint64_t head = head_.load(std::memory_order_relaxed);
+    const std::size_t offset = head & mask_;
+    const std::size_t until_end = capacity_ - offset;
+    const std::size_t needed = bytes <= until_end ? bytes : until_end + bytes;
+    if (head + needed - cached_tail_ > capacity_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head + needed - cached_tail_ > capacity_) return full;
+    }
+    char* at = data() + offset;
+    if (bytes > until_end) {
+      const uint32_t filler[2] = {static_cast<uint32_t>(until_end), log_record::padding};
+      std::memcpy(at, filler, sizeof(filler));
+      at = data();
+    }
+    write(at);
+    // Sequentially consistent with the stores and loads of drain() and
+    // empty(): either this load sees the consumer's tail reach the record,
+    // or the consumer sees the record before it decides to sleep.
+    head_.store(head + needed, std::memory_order_seq_cst);
+    cached_tail_ = tail_.load(std::memory_order_seq_cst);
+    return cached_tail_ == head ? pushed_into_empty : pushed;
+  }
+
+  template <class Read>
+  void drain(Read read) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    const uint64_t head = head_.load(std::memory_order_acquire);
+    while (tail != head) {
+      const char* at = data() + (tail & mask_);
+      uint32_t header[2];
+      std::memcpy(header, at, sizeof(header));
+      if (header[1] != log_record::padding) read(at);
+      tail += header[0];
+    }
+    tail_.store(tail, std::memory_order_seq_cst);
+  }
+
+  bool empty() const {
+    return head_.load(std::memory_order_seq_cst) == tail_.load(std::memory_order_relaxed);
+  }
+
+  std::size_t capacity() const { return capacity_; }
+  std::atomic<bool> closed{false};
+
+ private:
+  char* data() { return reinterpret_cast<char*>(buffer_.get()); }
+
+  const std::size_t capacity_;
+  const std::size_t mask_;
+  std::unique_ptr<uint64_t[]> buffer_;
+  // The producer's and the consumer's indices are kept on separate lines.
+  char padding_[64];
+  std::atomic<uint64_t> head_{0};
+  uint64_t cached_tail_ = 0;
+  char padding2_[64];
+  std::atomic<uint64_t> tail_{0};
+};
+
+// Owns the rings of every logging thread and the thread that empties them
+// into the output file in batches. The writer sleeps until a producer puts
+// a record into an empty ring; it never sleeps while a ring holds records.
+class async_logger {
+ public:
+  explicit async_logger(std::size_t capacity)
+      : capacity_(capacity), writer_([this] { run(); }) {}
+
+  ~async_logger() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    wake_.notify_all();
+    writer_.join();
+    if (file_.is_open()) file_.close();
+  }
+
+  async_logger(const async_logger&) = delete;
+  async_logger& operator=(const async_logger&) = delete;
+
+  // Output goes to stderr until a file is opened.
+  void open(const std::string& path) {
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    if (file_.is_open()) file_.close();
+    file_.open(path, std::ios::out | std::ios::app | std::ios::binary);
+  }
+
+  std::shared_ptr<log_ring> attach() {
+    auto ring = std::make_shared<log_ring>(capacity_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    rings_.push_back(ring);
+    return ring;
+  }
+
+  // Returns once everything logged before the call is written out.
+  void flush() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const uint64_t ticket = ++flush_requested_;
+    wake_.notify_all();
+    flushed_.wait(lock, [&] { return flush_done_ >= ticket; });
+  }
+
+  // Called by a producer whose record went into an empty ring. Taking the
+  // mutex keeps the notification from falling between the writer's last
+  // look at the rings and its wait.
+  void wake() {
+    { std::lock_guard<std::mutex> lock(mutex_); }
+    wake_.notify_one();
+  }
+  void drop() { dropped_.fetch_add(1, std::memory_order_relaxed); }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  void run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+      const uint64_t ticket = flush_requested_;
+      const bool stopping = stop_;
+      format_pending();
+      const std::string text = batch_.str();
+      batch_.str(std::string());
+      if (!text.empty()) {
+        lock.unlock();
+        write(text);
+        lock.lock();
+      }
+      flush_done_ = ticket;
+      flushed_.notify_all();
+      if (stopping) return;
+      wake_.wait(lock, [&] { return stop_ || flush_requested_ != ticket || pending(); });
+    }
+  }
+
+  bool pending() const {
+    for (const auto& ring : rings_) {
+      if (!ring->empty()) return true;
+    }
+    return false;
+  }
+
+  // Drains every ring into batch_. Runs under mutex_, which attach(),
+  // flush() and wake() contend for; the I/O happens after it is released.
+  void format_pending() {
+    for (auto it = rings_.begin(); it != rings_.end();) {
+      log_ring& ring = **it;
+      const bool closed = ring.closed.load(std::memory_order_acquire);
+      ring.drain([&](const char* at) {
+        log_record header;
+        std::memcpy(&header, at, sizeof(header));
+        const int64_t us = header.time_ns / 1000;
+        const uint32_t l = header.level & ~log_record::truncated;
+        batch_ << us / 1000000 << '.' << std::setw(6) << std::setfill('0') << us % 1000000
+               << ' ' << level_name(static_cast<level>(l)) << ' ';
+        header.format(batch_, at + sizeof(header));
+        if (header.level & log_record::truncated) batch_ << " [truncated]";
+        batch_ << '\n';
+      });
+      it = closed ? rings_.erase(it) : it + 1;
+    }
+  }
+
+  void write(const std::string& text) {
+    std::lock_guard<std::mutex> lock(file_mutex_);
+    std::ostream& out = file_.is_open() ? static_cast<std::ostream&>(file_) : std::cerr;
+    out.write(text.data(), text.size());
+    out.flush();
+  }
+
+  const std::size_t capacity_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable flushed_;
+  std::vector<std::shared_ptr<log_ring>> rings_;
+  std::ostringstream batch_;
+  std::mutex file_mutex_;  // Guards file_, which open() replaces.
+  std::ofstream file_;
+  uint64_t flush_requested_ = 0;
+  uint64_t flush_done_ = 0;
+  bool stop_ = false;
+  std::atomic<uint64_t> dropped_{0};
+  std::thread writer_;
+};
+
+// What a producer does when its ring is full.
+struct drop_on_overflow {
+  static const bool block = false;
+};
+
+struct block_on_overflow {
+  static const bool block = true;
+};
+
+// Log policy that never waits for I/O: the calling thread encodes its
+// arguments into its own ring buffer, and a background thread formats and
+// writes them. Messages below MinLevel compile to nothing. A record larger
+// than half the ring has its last strings cut to fit and is marked
+// "[truncated]"; one made only of numbers is rejected at compile time.
+template <level MinLevel = level::info, class Overflow = drop_on_overflow,
+          std::size_t Capacity = 64 * 1024>
+struct async_log {
+  static void print(const std::string& value) { log<level::info>(value); }
+
+  template <level Level>
+  struct enabled : std::integral_constant<bool, (Level >= MinLevel)> {};
+
+  template <level Level, class... Args,
+            typename std::enable_if<enabled<Level>::value>::type* = nullptr>
+  static void log(const Args&... args) {
+    static_assert(sum({!log_argument<Args>::fixed_size...}) != 0 ||
+                      sizeof(log_record) + sum({sizeof(Args)...}) <= limit,
+                  "a log record of numbers only must fit in half the ring");
+    const std::size_t payload = sum({log_argument<Args>::size(args)...});
+    std::size_t text = sum({log_argument<Args>::text_size(args)...});
+    std::size_t bytes = (sizeof(log_record) + payload + 7) / 8 * 8;
+    uint32_t flags = 0;
+    if (bytes > limit) {
+      // Many numbers next to a long string: only the numbers would not fit.
+      const std::size_t fixed = sizeof(log_record) + payload - text;
+      if (fixed > limit) {
+        logger().drop();
+        return;
+      }
+      text = limit - fixed;
+      bytes = limit;
+      flags = log_record::truncated;
+    }
+    const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    auto write = [&](char* at) {
+      const log_record header = {static_cast<uint32_t>(bytes),
+                                 static_cast<uint32_t>(Level) | flags,
+                                 &format_record<Args...>, now};
+      std::memcpy(at, &header, sizeof(header));
+      char* out = at + sizeof(header);
+      std::size_t budget = text;
+      const int expand[] = {0, (out = log_argument<Args>::write(out, args, budget), 0)...};
+      static_cast<void>(expand);
+    };
+    log_ring& ring = local();
+    for (;;) {
+      const log_ring::push_result result = ring.try_push(bytes, write);
+      if (result == log_ring::pushed_into_empty) logger().wake();
+      if (result != log_ring::full) return;
+      // A full ring is not empty, so the writer is already awake.
+      if (!Overflow::block) {
+        logger().drop();
+        return;
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  template <level Level, class... Args,
+            typename std::enable_if<!enabled<Level>::value>::type* = nullptr>
+  static void log(const Args&...) {}
+
+  static async_logger& logger() {
+    static async_logger instance(Capacity);
+    return instance;
+  }
+
+ private:
+  // Largest record a ring takes; a multiple of eight like every record.
+  static const std::size_t limit = Capacity / 2;
+
+  static constexpr std::size_t sum(std::initializer_list<std::size_t> sizes) {
+    std::size_t total = 0;
+    for (std::size_t size : sizes) total += size;
+    return total;
+  }
+
+  struct producer {
+    producer() : ring(logger().attach()) {}
+    ~producer() { ring->closed.store(true, std::memory_order_release); }
+    std::shared_ptr<log_ring> ring;
+  };
+
+  static log_ring& local() {
+    static thread_local producer p;
+    return *p.ring;
+  }
+};
+
 template <class LogPolicy>
 struct hoge {
   void foo() const {
@@ -33,14 +452,23 @@ struct ownership {
   typedef Strategy type;
 };
 
-struct reference_count {};
-struct deep_copy {};
+// Where smart_ptr gets the memory for its objects and control blocks.
+template <class Strategy>
+struct allocation {
+  typedef Strategy type;
+};
 
 template <bool IsMultiThread>
 struct multi_thread {
   static const bool value = IsMultiThread;
 };
 
+// Largest object deep_copy stores inside the pointer itself.
+template <std::size_t Bytes>
+struct inline_size {
+  static const std::size_t value = Bytes;
+};
+
 template <class>
 struct is_ownership_policy {
   static const bool value = false;
@@ -61,23 +489,56 @@ struct is_multi_thread_policy<multi_thread<IsMultiThread>> {
   static const bool value = true;
 };
 
-struct not_found {};
+template <class>
+struct is_allocation_policy {
+  static const bool value = false;
+};
 
-template <template <class> class Pred, class Head, class... Tail>
-struct find_if_impl {
-  typedef typename std::conditional<
-    Pred<Head>::value, Head,
-    typename find_if_impl<Pred, Tail...>::type>::type type;
+template <class Strategy>
+struct is_allocation_policy<allocation<Strategy>> {
+  static const bool value = true;
+};
+
+template <class>
+struct is_inline_size_policy {
+  static const bool value = false;
 };
 
-template <template <class> class Pred, class Head>
-struct find_if_impl<Pred, Head> {
-  typedef typename std::conditional<Pred<Head>::value, Head, not_found>::type type;
+template <std::size_t Bytes>
+struct is_inline_size_policy<inline_size<Bytes>> {
+  static const bool value = true;
+};
+
+struct not_found {};
+
+template <bool... Bs>
+constexpr std::size_t first_true() {
+  const bool flags[] = {Bs..., true};
+  std::size_t i = 0;
+  while (!flags[i]) ++i;
+  return i;
+}
+
+template <std::size_t I, class T>
+struct indexed {
+  typedef T type;
 };
 
+template <class Indices, class... List>
+struct indexer;
+
+template <std::size_t... I, class... List>
+struct indexer<std::index_sequence<I...>, List...> : indexed<I, List>... {};
+
+template <std::size_t I, class T>
+indexed<I, T> select(const indexed<I, T>&);
+
+// Looks up the first match in one step instead of recursing per policy;
+// not_found is appended so a miss selects it.
 template <template <class> class Pred, class... List>
 struct find_if {
-  typedef typename find_if_impl<Pred, List...>::type type;
+  typedef typename decltype(select<first_true<Pred<List>::value...>()>(
+      indexer<std::index_sequence_for<List..., not_found>, List..., not_found>()))::type type;
 };
 
 template <template <class> class Pred, class... List>
@@ -95,15 +556,1808 @@ struct get_optional_arg {
                                       result, Opt>::type type;
 };
 
+// Allocation strategies. Every one hands out memory aligned for any
+// fundamental type and is told the size again when it is given back.
+const std::size_t allocation_alignment = alignof(std::max_align_t);
+
+struct heap {
+  static void* allocate(std::size_t bytes) { return ::operator new(bytes); }
+  static void deallocate(void* p, std::size_t) { ::operator delete(p); }
+};
+
+// Blocks of a few fixed sizes, carved from slabs and recycled through a
+// free list per size. Slabs are kept for the life of the process; larger
+// requests go to the heap.
+struct pool {
+  static const std::size_t granularity = allocation_alignment;
+  static const std::size_t max_block = 512;
+  static const std::size_t blocks_per_slab = 64;
+
+  static void* allocate(std::size_t bytes) {
+    if (bytes > max_block) return ::operator new(bytes);
+    const std::size_t index = index_for(bytes);
+    size_class& c = classes()[index];
+    std::lock_guard<std::mutex> lock(c.mutex);
+    if (c.free == nullptr) {
+      const std::size_t block = (index + 1) * granularity;
+      char* slab = static_cast<char*>(::operator new(block * blocks_per_slab));
+      for (std::size_t i = 0; i < blocks_per_slab; ++i) {
+        c.free = new (slab + i * block) node{c.free};
+      }
+    }
+    node* n = c.free;
+    c.free = n->next;
+    return n;
+  }
+
+  static void deallocate(void* p, std::size_t bytes) {
+    if (bytes > max_block) {
+      ::operator delete(p);
+      return;
+    }
+    size_class& c = classes()[index_for(bytes)];
+    std::lock_guard<std::mutex> lock(c.mutex);
+    c.free = new (p) node{c.free};
+  }
+
+ private:
+  // Zero bytes get the smallest block, like one byte.
+  static std::size_t index_for(std::size_t bytes) {
+    return bytes == 0 ? 0 : (bytes - 1) / granularity;
+  }
+
+  struct node {
+    node* next;
+  };
+
+  struct size_class {
+    std::mutex mutex;
+    node* free = nullptr;
+  };
+
+  static size_class* classes() {
+    static size_class c[max_block / granularity];
+    return c;
+  }
+};
+
+// Monotonic allocation from large chunks: deallocate() does nothing and
+// release() frees every chunk at once, so it may only be called when no
+// object from this arena is alive. Each Tag is a separate arena.
+template <class Tag = void>
+struct arena {
+  static const std::size_t chunk_size = 64 * 1024;
+
+  static void* allocate(std::size_t bytes) {
+    bytes = (bytes + allocation_alignment - 1) / allocation_alignment * allocation_alignment;
+    state& s = get();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.chunks == nullptr || s.offset + bytes > s.chunks->size) {
+      const std::size_t needed = sizeof(chunk) + bytes;
+      const std::size_t size = needed > chunk_size ? needed : chunk_size;
+      s.chunks = new (::operator new(size)) chunk{s.chunks, size};
+      s.offset = sizeof(chunk);
+    }
+    void* p = reinterpret_cast<char*>(s.chunks) + s.offset;
+    s.offset += bytes;
+    s.used += bytes;
+    return p;
+  }
+
+  static void deallocate(void*, std::size_t) {}
+
+  static std::size_t bytes_used() {
+    state& s = get();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    return s.used;
+  }
+
+  static void release() {
+    state& s = get();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    while (s.chunks != nullptr) {
+      chunk* next = s.chunks->next;
+      ::operator delete(s.chunks);
+      s.chunks = next;
+    }
+    s.offset = 0;
+    s.used = 0;
+  }
+
+ private:
+  struct alignas(allocation_alignment) chunk {
+    chunk* next;
+    std::size_t size;
+  };
+
+  struct state {
+    std::mutex mutex;
+    chunk* chunks = nullptr;
+    std::size_t offset = 0;
+    std::size_t used = 0;
+  };
+
+  static state& get() {
+    static state s;
+    return s;
+  }
+};
+
+// A cache of free blocks per thread, so the allocating thread never locks.
+// A block freed by another thread is pushed onto its owner's lock-free
+// return stack, which the owner takes over when its own list runs dry.
+// The cache of an exited thread is handed to the next new thread.
+struct thread_local_freelist {
+  static const std::size_t classes = 6;  // 32 to 1024 bytes, header included.
+  static const std::size_t blocks_per_slab = 32;
+
+  static void* allocate(std::size_t bytes) {
+    const std::size_t total = bytes + sizeof(header);
+    if (total > block_size(classes - 1)) {
+      return new (::operator new(total)) header{nullptr, 0} + 1;
+    }
+    const std::size_t index = index_for(total);
+    cache& c = cache::local();
+    if (c.free[index] == nullptr) c.collect();
+    if (c.free[index] == nullptr) {
+      char* slab = static_cast<char*>(::operator new(block_size(index) * blocks_per_slab));
+      for (std::size_t i = 0; i < blocks_per_slab; ++i) {
+        header* h = new (slab + i * block_size(index)) header{&c, index};
+        c.push(h);
+      }
+    }
+    header* h = c.free[index];
+    c.free[index] = next(h);
+    return h + 1;
+  }
+
+  static void deallocate(void* p, std::size_t) {
+    header* h = static_cast<header*>(p) - 1;
+    if (h->owner == nullptr) {
+      ::operator delete(h);
+    } else if (h->owner == cache::current()) {
+      h->owner->push(h);
+    } else {
+      h->owner->push_remote(h);
+    }
+  }
+
+  // Size of the block, header included, that serves an allocation of the
+  // given size; 0 if the allocation goes to the heap.
+  static std::size_t block_size_for(std::size_t bytes) {
+    const std::size_t total = bytes + sizeof(header);
+    return total > block_size(classes - 1) ? 0 : block_size(index_for(total));
+  }
+
+ private:
+  class cache;
+
+  // Precedes every block.
+  struct alignas(allocation_alignment) header {
+    cache* owner;
+    std::size_t index;
+  };
+
+  // While a block is free, the first word after its header links it into a
+  // list; the smallest block leaves room for it.
+  static header*& next(header* h) { return *reinterpret_cast<header**>(h + 1); }
+
+  static std::size_t block_size(std::size_t index) { return std::size_t(32) << index; }
+
+  static std::size_t index_for(std::size_t total) {
+    std::size_t index = 0;
+    while (block_size(index) < total) ++index;
+    return index;
+  }
+
+  class cache {
+   public:
+    static cache& local() {
+      static thread_local holder h;
+      return *h.c;
+    }
+
+    // The calling thread's cache, or null if it has not allocated yet.
+    static cache*& current() {
+      static thread_local cache* c = nullptr;
+      return c;
+    }
+
+    void push(header* h) {
+      next(h) = free[h->index];
+      free[h->index] = h;
+    }
+
+    void push_remote(header* h) {
+      next(h) = returned_.load(std::memory_order_relaxed);
+      while (!returned_.compare_exchange_weak(next(h), h, std::memory_order_release,
+                                              std::memory_order_relaxed)) {
+      }
+    }
+
+    void collect() {
+      header* h = returned_.exchange(nullptr, std::memory_order_acquire);
+      while (h != nullptr) {
+        header* following = next(h);
+        push(h);
+        h = following;
+      }
+    }
+
+    header* free[classes] = {};
+
+   private:
+    struct holder {
+      holder() {
+        std::lock_guard<std::mutex> lock(orphans_mutex());
+        if (orphans().empty()) {
+          c = new cache;
+        } else {
+          c = orphans().back();
+          orphans().pop_back();
+        }
+        current() = c;
+      }
+      ~holder() {
+        current() = nullptr;
+        std::lock_guard<std::mutex> lock(orphans_mutex());
+        orphans().push_back(c);
+      }
+      cache* c;
+    };
+
+    // Never destroyed: threads may still exit during static destruction.
+    static std::vector<cache*>& orphans() {
+      static std::vector<cache*>* v = new std::vector<cache*>;
+      return *v;
+    }
+
+    static std::mutex& orphans_mutex() {
+      static std::mutex m;
+      return m;
+    }
+
+    std::atomic<header*> returned_{nullptr};
+  };
+};
+
+// Constructs a T in memory from the allocation strategy, and destroys it.
+template <class Allocation, class T, class... Params>
+T* allocate_object(Params&&... params) {
+  static_assert(alignof(T) <= allocation_alignment, "over-aligned types are not supported");
+  void* memory = Allocation::allocate(sizeof(T));
+  try {
+    return new (memory) T(std::forward<Params>(params)...);
+  } catch (...) {
+    Allocation::deallocate(memory, sizeof(T));
+    throw;
+  }
+}
+
+template <class Allocation, class T>
+void deallocate_object(T* object) {
+  object->~T();
+  Allocation::deallocate(object, sizeof(T));
+}
+
+// Reference count of a shared object. Single-threaded pointers pay for no
+// atomic instructions.
+template <bool IsMultiThread>
+class counter {
+ public:
+  void increment() { ++count_; }
+  bool decrement() { return --count_ == 0; }
+  std::size_t get() const { return count_; }
+
+ private:
+  std::size_t count_ = 1;
+};
+
+// A new reference is always copied from a live one, so incrementing needs
+// no ordering; the last decrement must see every other owner's writes
+// before the object is destroyed.
+template <>
+class counter<true> {
+ public:
+  void increment() { count_.fetch_add(1, std::memory_order_relaxed); }
+  bool decrement() { return count_.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+  // Acquire, so that a count of one also means the other owners are done.
+  std::size_t get() const { return count_.load(std::memory_order_acquire); }
+
+ private:
+  std::atomic<std::size_t> count_{1};
+};
+
+struct in_place_t {};
+constexpr in_place_t in_place{};
+
+// Shared ownership. The count and the object live in one allocation and the
+// pointer is a single pointer to it.
+struct reference_count {
+  template <class T, class Policies>
+  class pointer {
+   public:
+    pointer() = default;
+
+    template <class... Params>
+    explicit pointer(in_place_t, Params&&... params)
+        : block_(allocate_object<allocator, block>(std::forward<Params>(params)...)) {}
+
+    pointer(const pointer& other) : block_(other.block_) {
+      if (block_ != nullptr) block_->count.increment();
+    }
+    pointer(pointer&& other) noexcept : block_(other.block_) { other.block_ = nullptr; }
+    pointer& operator=(pointer other) noexcept {
+      swap(other);
+      return *this;
+    }
+    ~pointer() { release(); }
+
+    T* get() const { return block_ != nullptr ? &block_->value : nullptr; }
+    std::size_t use_count() const { return block_ != nullptr ? block_->count.get() : 0; }
+    void reset() { pointer().swap(*this); }
+    void swap(pointer& other) noexcept { std::swap(block_, other.block_); }
+
+   private:
+    struct block {
+      template <class... Params>
+      explicit block(Params&&... params) : value(std::forward<Params>(params)...) {}
+
+      counter<Policies::multi_thread_policy::value> count;
+      T value;
+    };
+
+    void release() {
+      if (block_ != nullptr && block_->count.decrement()) {
+        deallocate_object<allocator>(block_);
+      }
+    }
+
+    typedef typename Policies::allocation_policy::type allocator;
+    block* block_ = nullptr;
+  };
+};
+
+// Value semantics: copying the pointer copies the object. Objects no larger
+// than the inline_size policy, and cheap to move, live inside the pointer
+// and never touch the heap.
+struct deep_copy {
+  template <class T, class Policies,
+            bool Inline = sizeof(T) <= Policies::inline_size_policy::value &&
+                          alignof(T) <= alignof(std::max_align_t) &&
+                          std::is_nothrow_move_constructible<T>::value>
+  class pointer {
+   public:
+    static const bool stored_inline = false;
+
+    pointer() = default;
+
+    template <class... Params>
+    explicit pointer(in_place_t, Params&&... params)
+        : value_(allocate_object<allocator, T>(std::forward<Params>(params)...)) {}
+
+    pointer(const pointer& other)
+        : value_(other.value_ != nullptr ? allocate_object<allocator, T>(*other.value_) : nullptr) {}
+    pointer(pointer&& other) noexcept : value_(other.value_) { other.value_ = nullptr; }
+    pointer& operator=(pointer other) noexcept {
+      swap(other);
+      return *this;
+    }
+    ~pointer() {
+      if (value_ != nullptr) deallocate_object<allocator>(value_);
+    }
+
+    const T* get() const { return value_; }
+    T* get() { return value_; }
+    void reset() { pointer().swap(*this); }
+    void swap(pointer& other) noexcept { std::swap(value_, other.value_); }
+
+   private:
+    typedef typename Policies::allocation_policy::type allocator;
+    T* value_ = nullptr;
+  };
+
+  template <class T, class Policies>
+  class pointer<T, Policies, true> {
+   public:
+    static const bool stored_inline = true;
+
+    pointer() = default;
+
+    template <class... Params>
+    explicit pointer(in_place_t, Params&&... params) {
+      new (&buffer_) T(std::forward<Params>(params)...);
+      engaged_ = true;
+    }
+
+    pointer(const pointer& other) {
+      if (other.engaged_) {
+        new (&buffer_) T(*other.get());
+        engaged_ = true;
+      }
+    }
+    pointer(pointer&& other) noexcept {
+      if (other.engaged_) {
+        new (&buffer_) T(std::move(*other.get()));
+        engaged_ = true;
+        other.reset();
+      }
+    }
+    pointer& operator=(pointer other) noexcept {
+      swap(other);
+      return *this;
+    }
+    ~pointer() { reset(); }
+
+    const T* get() const { return engaged_ ? reinterpret_cast<const T*>(&buffer_) : nullptr; }
+    T* get() { return engaged_ ? reinterpret_cast<T*>(&buffer_) : nullptr; }
+
+    void reset() {
+      if (engaged_) {
+        get()->~T();
+        engaged_ = false;
+      }
+    }
+
+    void swap(pointer& other) noexcept {
+      if (engaged_ && other.engaged_) {
+        T value(std::move(*get()));
+        get()->~T();
+        new (&buffer_) T(std::move(*other.get()));
+        other.get()->~T();
+        new (&other.buffer_) T(std::move(value));
+      } else if (engaged_) {
+        new (&other.buffer_) T(std::move(*get()));
+        other.engaged_ = true;
+        reset();
+      } else if (other.engaged_) {
+        other.swap(*this);
+      }
+    }
+
+   private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type buffer_;
+    bool engaged_ = false;
+  };
+};
+
+// Shares the object between copies until one of them is modified. get(),
+// * and -> only read, even on a non-const pointer; mutate() first gives the
+// copy an object of its own and returns it for writing.
+struct copy_on_write {
+  template <class T, class Policies>
+  class pointer {
+   public:
+    pointer() = default;
+
+    template <class... Params>
+    explicit pointer(in_place_t, Params&&... params)
+        : shared_(in_place, std::forward<Params>(params)...) {}
+
+    const T* get() const { return shared_.get(); }
+
+    T* mutate() {
+      if (shared_.use_count() > 1) shared_ = shared_type(in_place, *shared_.get());
+      return shared_.get();
+    }
+
+    std::size_t use_count() const { return shared_.use_count(); }
+    void reset() { shared_.reset(); }
+    void swap(pointer& other) noexcept { shared_.swap(other.shared_); }
+
+   private:
+    typedef reference_count::pointer<T, Policies> shared_type;
+    shared_type shared_;
+  };
+};
+
+// Shared ownership for objects copied far more often than they are
+// created, after Choi et al., "Biased Reference Counting" (PACT 2018). The
+// thread that created the object counts its own references without atomics;
+// other threads count theirs in shards, one cache line each, picked by
+// thread, so that threads copying the same object do not contend. When a
+// shard drops below zero, other threads may have dropped more references
+// than they took, and the object is queued to its owner. The owner merges
+// its count and the shards into one shared counter the next time it calls
+// make() or collect(), or when it exits; zero is only detected on that
+// counter, so destruction can be deferred until then. Always thread-safe;
+// multi_thread is ignored.
+struct biased_reference_count {
+  class owner_record;
+
+  static const std::size_t shard_count = 8;
+
+  // Allocated by the first other thread that copies the object.
+  struct shards {
+    struct padded_count {
+      // References taken minus references dropped on this shard, times
+      // four, with the merged flag set once the owner has summed it.
+      std::atomic<std::int64_t> count{0};
+      char padding[64 - sizeof(std::atomic<std::int64_t>)];
+    };
+    padded_count shard[shard_count];
+  };
+
+  struct block {
+    typedef void (*destroy_function)(block*);
+
+    block(owner_record* owner, destroy_function destroy) : owner(owner), destroy(destroy) {}
+
+    // Written by the owning thread only.
+    owner_record* const owner;
+    block* prev = nullptr;
+    block* next = nullptr;
+    std::size_t biased = 1;
+    bool merged_by_owner = false;
+    const destroy_function destroy;
+
+    char padding[64];
+    // Count of every reference once merged, times four, with the merged and
+    // queued flags in the low bits. Before the merge it only holds the
+    // queued flag, and the references of threads that found their shard
+    // already summed. Goes negative while the owner holds references that
+    // other threads have released.
+    std::atomic<std::int64_t> shared{0};
+    // Null until another thread copies the object, closed_shards() once the
+    // owner has merged without any.
+    std::atomic<shards*> sharded{nullptr};
+    char padding2[64 - sizeof(std::atomic<std::int64_t>) - sizeof(std::atomic<shards*>)];
+  };
+
+  static const std::int64_t merged = 1;
+  static const std::int64_t queued = 2;
+  static const std::int64_t one = 4;
+
+  static std::int64_t count(std::int64_t state) { return (state & ~(merged | queued)) / one; }
+
+  // Stands for the shards of a block merged before any were allocated; it
+  // is never written.
+  static shards* closed_shards() {
+    static shards closed;
+    return &closed;
+  }
+
+  // Threads take shards in turn, so that up to shard_count threads each
+  // have one of their own.
+  static std::size_t shard_index() {
+    static std::atomic<std::size_t> next{0};
+    static thread_local std::size_t index = 0;  // One past the shard, once taken.
+    if (index == 0) index = next.fetch_add(1, std::memory_order_relaxed) % shard_count + 1;
+    return index - 1;
+  }
+
+  // Flags every shard as merged and returns the sum of their counts.
+  // Threads that update a shard afterwards see the flag and use the shared
+  // counter instead.
+  static std::int64_t close_shards(block* b) {
+    shards* s = nullptr;
+    if (b->sharded.compare_exchange_strong(s, closed_shards(), std::memory_order_acq_rel)) {
+      return 0;
+    }
+    std::int64_t sum = 0;
+    for (auto& shard : s->shard) {
+      sum += shard.count.exchange(merged, std::memory_order_acq_rel) / one;
+    }
+    return sum;
+  }
+
+  class owner_record {
+   public:
+    static owner_record* current() { return local().record; }
+
+    static owner_record* current_or_create() {
+      thread_owner& t = local();
+      if (t.record == nullptr) t.record = new owner_record;
+      return t.record;
+    }
+
+    void adopt(block* b) {
+      refs_.fetch_add(1, std::memory_order_relaxed);
+      b->next = owned_;
+      if (owned_ != nullptr) owned_->prev = b;
+      owned_ = b;
+    }
+
+    void release() {
+      if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+    }
+
+    // Called by another thread that holds the queued claim on b. Once the
+    // owner has exited, every block it owned is merged and the caller
+    // finishes the job itself.
+    void enqueue(block* b) {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!exited_) {
+          queue_.push_back(b);
+          has_queued_.store(true, std::memory_order_release);
+          return;
+        }
+      }
+      finalize(b);
+    }
+
+    void collect() {
+      if (!has_queued_.load(std::memory_order_acquire)) return;
+      std::vector<block*> queue;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue.swap(queue_);
+        has_queued_.store(false, std::memory_order_relaxed);
+      }
+      process(queue);
+    }
+
+    // Folds the owner's references into the shared count; from then on every
+    // thread, the owner included, uses the shared count only.
+    void merge(block* b) {
+      b->merged_by_owner = true;
+      if (b->prev != nullptr) b->prev->next = b->next;
+      if (b->next != nullptr) b->next->prev = b->prev;
+      if (owned_ == b) owned_ = b->next;
+      const std::int64_t delta =
+          (static_cast<std::int64_t>(b->biased) + close_shards(b)) * one + merged;
+      b->biased = 0;
+      const std::int64_t state = b->shared.fetch_add(delta, std::memory_order_acq_rel) + delta;
+      if (count(state) == 0 && !(state & queued)) free(b);
+    }
+
+   private:
+    struct thread_owner {
+      owner_record* record = nullptr;
+      ~thread_owner() {
+        if (record != nullptr) record->exit();
+      }
+    };
+
+    static thread_owner& local() {
+      static thread_local thread_owner t;
+      return t;
+    }
+
+    owner_record() = default;
+
+    void exit() {
+      std::vector<block*> queue;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (owned_ != nullptr) merge(owned_);
+        exited_ = true;
+        queue.swap(queue_);
+      }
+      process(queue);
+      release();
+    }
+
+    void process(const std::vector<block*>& queue) {
+      for (block* b : queue) {
+        if (!b->merged_by_owner) merge(b);
+        finalize(b);
+      }
+    }
+
+    std::mutex mutex_;
+    std::vector<block*> queue_;
+    std::atomic<bool> has_queued_{false};
+    bool exited_ = false;
+    std::atomic<std::size_t> refs_{1};  // The thread, plus one per live block.
+    block* owned_ = nullptr;
+  };
+
+  static void free(block* b) {
+    owner_record* owner = b->owner;
+    shards* s = b->sharded.load(std::memory_order_relaxed);
+    if (s != closed_shards()) delete s;
+    b->destroy(b);
+    owner->release();
+  }
+
+  // Drops the queued claim on a merged block, destroying it if no
+  // references are left.
+  static void finalize(block* b) {
+    std::int64_t state = b->shared.load(std::memory_order_acquire);
+    for (;;) {
+      if (count(state) == 0) {
+        free(b);
+        return;
+      }
+      if (b->shared.compare_exchange_weak(state, state & ~queued, std::memory_order_acq_rel,
+                                          std::memory_order_acquire)) {
+        return;
+      }
+    }
+  }
+
+  static bool owned_here(const block* b) {
+    return b->owner == owner_record::current() && !b->merged_by_owner;
+  }
+
+  // This thread's shard of b, allocating the shards on first use, or null
+  // once the owner has merged.
+  static std::atomic<std::int64_t>* shard_of(block* b) {
+    shards* s = b->sharded.load(std::memory_order_acquire);
+    if (s == nullptr) {
+      std::unique_ptr<shards> fresh(new shards);
+      if (b->sharded.compare_exchange_strong(s, fresh.get(), std::memory_order_acq_rel)) {
+        s = fresh.release();
+      }
+    }
+    return s == closed_shards() ? nullptr : &s->shard[shard_index()].count;
+  }
+
+  static void increment(block* b) {
+    if (owned_here(b)) {
+      ++b->biased;
+      return;
+    }
+    std::atomic<std::int64_t>* shard = shard_of(b);
+    if (shard == nullptr || (shard->fetch_add(one, std::memory_order_relaxed) & merged)) {
+      b->shared.fetch_add(one, std::memory_order_relaxed);
+    }
+  }
+
+  static void decrement(block* b) {
+    if (owned_here(b)) {
+      if (--b->biased == 0) b->owner->merge(b);
+      return;
+    }
+    if (std::atomic<std::int64_t>* shard = shard_of(b)) {
+      const std::int64_t before = shard->fetch_sub(one, std::memory_order_acq_rel);
+      if (!(before & merged)) {
+        // The shards only sum below zero if one of them is below zero, so
+        // the thread that takes a shard there queues the object to its owner.
+        if (count(before) <= 0) claim(b);
+        return;
+      }
+    }
+    std::int64_t state = b->shared.load(std::memory_order_relaxed);
+    for (;;) {
+      std::int64_t next = state - one;
+      const bool claim = !(state & (merged | queued)) && count(next) < 0;
+      if (claim) next |= queued;
+      if (b->shared.compare_exchange_weak(state, next, std::memory_order_acq_rel,
+                                          std::memory_order_relaxed)) {
+        if (claim) {
+          b->owner->enqueue(b);
+        } else if ((next & merged) && !(next & queued) && count(next) == 0) {
+          free(b);
+        }
+        return;
+      }
+    }
+  }
+
+  // Queues b to its owner for merging, unless it already is queued or merged.
+  static void claim(block* b) {
+    std::int64_t state = b->shared.load(std::memory_order_relaxed);
+    while (!(state & (merged | queued))) {
+      if (b->shared.compare_exchange_weak(state, state | queued, std::memory_order_acq_rel,
+                                          std::memory_order_relaxed)) {
+        b->owner->enqueue(b);
+        return;
+      }
+    }
+  }
+
+  // Merges the objects other threads have handed back to this thread.
+  static void collect() {
+    if (owner_record* owner = owner_record::current()) owner->collect();
+  }
+
+  template <class T, class Policies>
+  class pointer {
+   public:
+    pointer() = default;
+
+    template <class... Params>
+    explicit pointer(in_place_t, Params&&... params) {
+      owner_record* owner = owner_record::current_or_create();
+      owner->collect();
+      block_ = allocate_object<typename Policies::allocation_policy::type, typed_block>(
+          owner, std::forward<Params>(params)...);
+      owner->adopt(block_);
+    }
+
+    pointer(const pointer& other) : block_(other.block_) {
+      if (block_ != nullptr) increment(block_);
+    }
+    pointer(pointer&& other) noexcept : block_(other.block_) { other.block_ = nullptr; }
+    pointer& operator=(pointer other) noexcept {
+      swap(other);
+      return *this;
+    }
+    ~pointer() {
+      if (block_ != nullptr) decrement(block_);
+    }
+
+    T* get() const { return block_ != nullptr ? &static_cast<typed_block*>(block_)->value : nullptr; }
+    void reset() { pointer().swap(*this); }
+    void swap(pointer& other) noexcept { std::swap(block_, other.block_); }
+
+   private:
+    struct typed_block : block {
+      template <class... Params>
+      explicit typed_block(owner_record* owner, Params&&... params)
+          : block(owner, &destroy), value(std::forward<Params>(params)...) {}
+
+      static void destroy(block* b) {
+        deallocate_object<typename Policies::allocation_policy::type>(static_cast<typed_block*>(b));
+      }
+
+      T value;
+    };
+
+    block* block_ = nullptr;
+  };
+};
+
 template <class... Args>
-struct smart_ptr {
+struct smart_ptr_policies {
   typedef typename get_required_arg<is_ownership_policy, Args...>::type ownership_policy;
 
   typedef typename get_optional_arg<multi_thread<false>, is_multi_thread_policy,
                                     Args...>::type multi_thread_policy;
+
+  typedef typename get_optional_arg<inline_size<3 * sizeof(void*)>, is_inline_size_policy,
+                                    Args...>::type inline_size_policy;
+
+  typedef typename get_optional_arg<allocation<heap>, is_allocation_policy,
+                                    Args...>::type allocation_policy;
+};
+
+// The ownership strategy supplies storage, copying and get(); the pointer
+// interface on top is shared by all of them.
+template <class T, class... Args>
+class smart_ptr : public smart_ptr_policies<Args...>::ownership_policy::type::template pointer<
+                      T, smart_ptr_policies<Args...>> {
+  typedef typename smart_ptr_policies<Args...>::ownership_policy::type::template pointer<
+      T, smart_ptr_policies<Args...>> base;
+
+ public:
+  typedef T element_type;
+  typedef typename smart_ptr_policies<Args...>::ownership_policy ownership_policy;
+  typedef typename smart_ptr_policies<Args...>::multi_thread_policy multi_thread_policy;
+  typedef typename smart_ptr_policies<Args...>::allocation_policy allocation_policy;
+
+  using base::base;
+  smart_ptr() = default;
+
+  template <class... Params>
+  static smart_ptr make(Params&&... params) {
+    return smart_ptr(in_place, std::forward<Params>(params)...);
+  }
+
+  auto operator*() const -> decltype(*std::declval<const base&>().get()) { return *this->get(); }
+  auto operator*() -> decltype(*std::declval<base&>().get()) { return *this->get(); }
+  auto operator->() const -> decltype(std::declval<const base&>().get()) { return this->get(); }
+  auto operator->() -> decltype(std::declval<base&>().get()) { return this->get(); }
+  explicit operator bool() const { return this->get() != nullptr; }
+};
+
+// Policies of bounded_queue. Which threads push and pop:
+struct spsc {};
+struct mpsc {};
+struct mpmc {};
+
+template <class Topology>
+struct topology {
+  typedef Topology type;
+};
+
+template <class>
+struct is_topology_policy {
+  static const bool value = false;
+};
+
+template <class Topology>
+struct is_topology_policy<topology<Topology>> {
+  static const bool value = true;
+};
+
+// How a blocking push or pop waits. The queue signals an event after every
+// successful operation; only park acts on it.
+class event {
+ public:
+  std::atomic<uint32_t> epoch{0};
+  std::atomic<uint32_t> waiters{0};
+};
+
+inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
+struct spin {
+  template <class TryOperation>
+  static void until(event&, TryOperation operation) {
+    while (!operation()) cpu_relax();
+  }
+  static void notify(event&) {}
+};
+
+struct yield {
+  template <class TryOperation>
+  static void until(event&, TryOperation operation) {
+    while (!operation()) std::this_thread::yield();
+  }
+  static void notify(event&) {}
+};
+
+// Spins briefly, then sleeps on a futex (yields on other systems). A waiter
+// announces itself before its last try and a notifier checks for waiters
+// after its operation, both with a seq_cst read-modify-write of waiters, so
+// either the try succeeds or the notifier sees the waiter and bumps the
+// epoch. An RMW rather than a fence keeps the handshake visible to
+// ThreadSanitizer, which does not model fences.
+struct park {
+  static const int spins = 64;
+
+  template <class TryOperation>
+  static void until(event& e, TryOperation operation) {
+    for (int i = 0; i < spins; ++i) {
+      if (operation()) return;
+      cpu_relax();
+    }
+    for (;;) {
+      const uint32_t seen = e.epoch.load(std::memory_order_acquire);
+      e.waiters.fetch_add(1, std::memory_order_seq_cst);
+      const bool done = operation();
+      if (!done) sleep(e.epoch, seen);
+      e.waiters.fetch_sub(1, std::memory_order_relaxed);
+      if (done || operation()) return;
+    }
+  }
+
+  static void notify(event& e) {
+    if (e.waiters.fetch_add(0, std::memory_order_seq_cst) == 0) return;
+    e.epoch.fetch_add(1, std::memory_order_release);
+#if defined(__linux__)
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&e.epoch), FUTEX_WAKE_PRIVATE, INT32_MAX,
+            nullptr, nullptr, 0);
+#endif
+  }
+
+ private:
+  static void sleep(std::atomic<uint32_t>& word, uint32_t seen) {
+#if defined(__linux__)
+    static_assert(sizeof(word) == sizeof(uint32_t), "futex needs a plain 32-bit word");
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT_PRIVATE, seen,
+            nullptr, nullptr, 0);
+#else
+    static_cast<void>(word);
+    static_cast<void>(seen);
+    std::this_thread::yield();
+#endif
+  }
+};
+
+template <class Strategy>
+struct waiting {
+  typedef Strategy type;
+};
+
+template <class>
+struct is_waiting_policy {
+  static const bool value = false;
+};
+
+template <class Strategy>
+struct is_waiting_policy<waiting<Strategy>> {
+  static const bool value = true;
+};
+
+// Number of elements, a power of two.
+template <std::size_t N>
+struct capacity {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "capacity must be a power of two");
+  static const std::size_t value = N;
+};
+
+template <class>
+struct is_capacity_policy {
+  static const bool value = false;
+};
+
+template <std::size_t N>
+struct is_capacity_policy<capacity<N>> {
+  static const bool value = true;
+};
+
+// Uninitialized slots for the rings below.
+template <class T, std::size_t N>
+class slots {
+ public:
+  T* at(std::size_t i) { return reinterpret_cast<T*>(&storage_[i & (N - 1)]); }
+
+ private:
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type storage_[N];
+};
+
+const std::size_t cache_line = 64;
+
+// The rings below pop in two steps: try_claim hands out the oldest slot and
+// its position, and release destroys the value in it and frees the slot, so
+// the caller can move the value wherever it needs to go.
+
+// For multi_thread<false>: no atomics at all.
+template <class T, std::size_t N>
+class plain_ring {
+ public:
+  ~plain_ring() {
+    for (; head_ != tail_; ++head_) slots_.at(head_)->~T();
+  }
+
+  template <class U>
+  bool try_push(U&& value) {
+    if (tail_ - head_ == N) return false;
+    new (slots_.at(tail_)) T(std::forward<U>(value));
+    ++tail_;
+    return true;
+  }
+
+  T* try_claim(std::size_t& position) {
+    if (head_ == tail_) return nullptr;
+    position = head_;
+    return slots_.at(head_);
+  }
+
+  void release(std::size_t position) {
+    slots_.at(position)->~T();
+    head_ = position + 1;
+  }
+
+ private:
+  std::size_t head_ = 0;
+  std::size_t tail_ = 0;
+  slots<T, N> slots_;
 };
 
+// One producer, one consumer. Each side keeps its own index and a cached
+// copy of the other's on its own cache line, and reads the other side's
+// index only when the cached one says the ring is full or empty.
+template <class T, std::size_t N>
+class spsc_ring {
+ public:
+  ~spsc_ring() {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    for (std::size_t head = head_.load(std::memory_order_relaxed); head != tail; ++head) {
+      slots_.at(head)->~T();
+    }
+  }
+
+  template <class U>
+  bool try_push(U&& value) {
+    const std::size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cached_head_ == N) {
+      cached_head_ = head_.load(std::memory_order_acquire);
+      if (tail - cached_head_ == N) return false;
+    }
+    new (slots_.at(tail)) T(std::forward<U>(value));
+    tail_.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  T* try_claim(std::size_t& position) {
+    const std::size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cached_tail_) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (head == cached_tail_) return nullptr;
+    }
+    position = head;
+    return slots_.at(head);
+  }
+
+  void release(std::size_t position) {
+    slots_.at(position)->~T();
+    head_.store(position + 1, std::memory_order_release);
+  }
+
+ private:
+  char padding0_[cache_line];
+  std::atomic<std::size_t> head_{0};
+  std::size_t cached_tail_ = 0;
+  char padding1_[cache_line];
+  std::atomic<std::size_t> tail_{0};
+  std::size_t cached_head_ = 0;
+  char padding2_[cache_line];
+  slots<T, N> slots_;
+};
+
+// Any number of producers and consumers, after Vyukov's bounded MPMC queue:
+// each cell carries a sequence number that says whether it is ready for the
+// producer or the consumer of a given position, so claiming a position is
+// one compare-and-swap.
+template <class T, std::size_t N>
+class mpmc_ring {
+ public:
+  mpmc_ring() {
+    for (std::size_t i = 0; i < N; ++i) cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+
+  // No operation is in flight any more, so every position between the two
+  // counters holds a value.
+  ~mpmc_ring() {
+    const std::size_t enqueue = enqueue_.load(std::memory_order_relaxed);
+    for (std::size_t p = dequeue_.load(std::memory_order_relaxed); p != enqueue; ++p) {
+      reinterpret_cast<T*>(&cells_[p & (N - 1)].storage)->~T();
+    }
+  }
+
+  template <class U>
+  bool try_push(U&& value) {
+    std::size_t position = enqueue_.load(std::memory_order_relaxed);
+    cell* c;
+    for (;;) {
+      c = &cells_[position & (N - 1)];
+      const std::size_t sequence = c->sequence.load(std::memory_order_acquire);
+      const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence - position);
+      if (diff == 0) {
+        if (enqueue_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        position = enqueue_.load(std::memory_order_relaxed);
+      }
+    }
+    new (&c->storage) T(std::forward<U>(value));
+    c->sequence.store(position + 1, std::memory_order_release);
+    return true;
+  }
+
+  T* try_claim(std::size_t& claimed) {
+    std::size_t position = dequeue_.load(std::memory_order_relaxed);
+    cell* c;
+    for (;;) {
+      c = &cells_[position & (N - 1)];
+      const std::size_t sequence = c->sequence.load(std::memory_order_acquire);
+      const std::ptrdiff_t diff = static_cast<std::ptrdiff_t>(sequence - (position + 1));
+      if (diff == 0) {
+        if (dequeue_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return nullptr;
+      } else {
+        position = dequeue_.load(std::memory_order_relaxed);
+      }
+    }
+    claimed = position;
+    return reinterpret_cast<T*>(&c->storage);
+  }
+
+  void release(std::size_t position) {
+    cell& c = cells_[position & (N - 1)];
+    reinterpret_cast<T*>(&c.storage)->~T();
+    c.sequence.store(position + N, std::memory_order_release);
+  }
+
+ protected:
+  struct cell {
+    std::atomic<std::size_t> sequence;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+  char padding0_[cache_line];
+  std::atomic<std::size_t> enqueue_{0};
+  char padding1_[cache_line];
+  std::atomic<std::size_t> dequeue_{0};
+  char padding2_[cache_line];
+  cell cells_[N];
+};
+
+// Any number of producers, one consumer. Producers claim positions as in
+// mpmc_ring; the consumer is the only writer of the dequeue position, so it
+// takes the oldest cell by checking its sequence number, without a
+// compare-and-swap or a retry.
+template <class T, std::size_t N>
+class mpsc_ring : public mpmc_ring<T, N> {
+ public:
+  T* try_claim(std::size_t& claimed) {
+    const std::size_t position = this->dequeue_.load(std::memory_order_relaxed);
+    auto& c = this->cells_[position & (N - 1)];
+    if (c.sequence.load(std::memory_order_acquire) != position + 1) return nullptr;
+    claimed = position;
+    return reinterpret_cast<T*>(&c.storage);
+  }
+
+  void release(std::size_t position) {
+    mpmc_ring<T, N>::release(position);
+    this->dequeue_.store(position + 1, std::memory_order_relaxed);
+  }
+};
+
+template <class T, class... Args>
+struct bounded_queue_policies {
+  typedef typename get_optional_arg<topology<mpmc>, is_topology_policy, Args...>::type
+      topology_policy;
+  typedef typename get_optional_arg<waiting<yield>, is_waiting_policy, Args...>::type
+      waiting_policy;
+  typedef typename get_optional_arg<capacity<1024>, is_capacity_policy, Args...>::type
+      capacity_policy;
+  typedef typename get_optional_arg<multi_thread<true>, is_multi_thread_policy, Args...>::type
+      multi_thread_policy;
+
+  static const std::size_t size = capacity_policy::value;
+  typedef typename topology_policy::type topology_type;
+  typedef typename std::conditional<
+      !multi_thread_policy::value, plain_ring<T, size>,
+      typename std::conditional<
+          std::is_same<topology_type, spsc>::value, spsc_ring<T, size>,
+          typename std::conditional<std::is_same<topology_type, mpsc>::value, mpsc_ring<T, size>,
+                                    mpmc_ring<T, size>>::type>::type>::type ring_type;
+};
+
+// Fixed-capacity FIFO configured by policies, all optional: topology<>
+// (mpmc), waiting<> for the blocking calls (yield), capacity<> (1024) and
+// multi_thread<> (true). With multi_thread<false> the blocking calls cannot
+// wait for another thread and throw instead.
+template <class T, class... Args>
+class bounded_queue {
+  typedef bounded_queue_policies<T, Args...> policies;
+  typedef typename policies::waiting_policy::type wait_strategy;
+
+ public:
+  typedef T value_type;
+  typedef typename policies::topology_policy topology_policy;
+  typedef typename policies::waiting_policy waiting_policy;
+  typedef typename policies::capacity_policy capacity_policy;
+  typedef typename policies::multi_thread_policy multi_thread_policy;
+  typedef typename policies::ring_type ring_type;
+
+  bounded_queue() = default;
+  bounded_queue(const bounded_queue&) = delete;
+  bounded_queue& operator=(const bounded_queue&) = delete;
+
+  static constexpr std::size_t capacity() { return capacity_policy::value; }
+
+  template <class U>
+  bool try_push(U&& value) {
+    if (!ring_.try_push(std::forward<U>(value))) return false;
+    wait_strategy::notify(not_empty_);
+    return true;
+  }
+
+  bool try_pop(T& out) {
+    std::size_t position;
+    T* slot = ring_.try_claim(position);
+    if (slot == nullptr) return false;
+    claim claimed(*this, position);
+    out = std::move(*slot);
+    return true;
+  }
+
+  template <class U>
+  void push(U&& value) {
+    push(std::forward<U>(value), multi_thread_policy());
+  }
+
+  T pop() {
+    std::size_t position;
+    T* slot = claim_front(position, multi_thread_policy());
+    claim claimed(*this, position);
+    T value(std::move(*slot));
+    return value;
+  }
+
+ private:
+  // Frees a claimed slot once its value has been moved out, or if moving it
+  // throws.
+  class claim {
+   public:
+    claim(bounded_queue& queue, std::size_t position) : queue_(queue), position_(position) {}
+    claim(const claim&) = delete;
+    claim& operator=(const claim&) = delete;
+    ~claim() {
+      queue_.ring_.release(position_);
+      wait_strategy::notify(queue_.not_full_);
+    }
+
+   private:
+    bounded_queue& queue_;
+    std::size_t position_;
+  };
+
+  template <class U>
+  void push(U&& value, multi_thread<true>) {
+    // A failed try_push leaves value untouched, so it can be retried.
+    wait_strategy::until(not_full_, [&] { return ring_.try_push(std::forward<U>(value)); });
+    wait_strategy::notify(not_empty_);
+  }
+
+  template <class U>
+  void push(U&& value, multi_thread<false>) {
+    if (!try_push(std::forward<U>(value))) throw std::length_error("bounded_queue is full");
+  }
+
+  T* claim_front(std::size_t& position, multi_thread<true>) {
+    T* slot = nullptr;
+    wait_strategy::until(not_empty_, [&] { return (slot = ring_.try_claim(position)) != nullptr; });
+    return slot;
+  }
+
+  T* claim_front(std::size_t& position, multi_thread<false>) {
+    T* slot = ring_.try_claim(position);
+    if (slot == nullptr) throw std::out_of_range("bounded_queue is empty");
+    return slot;
+  }
+
+  ring_type ring_;
+  event not_empty_;
+  event not_full_;
+};
+
+TEST_F(POLICY, FindIf) {
+  static_assert(std::is_same<find_if<is_multi_thread_policy, ownership<deep_copy>,
+                                     multi_thread<true>>::type,
+                             multi_thread<true>>::value, "found");
+  static_assert(std::is_same<find_if<is_multi_thread_policy, ownership<deep_copy>>::type,
+                             not_found>::value, "not found");
+  static_assert(std::is_same<get_optional_arg<multi_thread<false>, is_multi_thread_policy>::type,
+                             multi_thread<false>>::value, "default");
+}
+
 TEST_F(POLICY, SmartPointer) {
-  smart_ptr<multi_thread<true>, ownership<reference_count>> p;
+  smart_ptr<int, multi_thread<true>, ownership<reference_count>> p;
+  EXPECT_FALSE(p);
+  EXPECT_EQ(0u, p.use_count());
+
+  typedef smart_ptr<std::string, ownership<reference_count>> shared_string;
+  static_assert(!shared_string::multi_thread_policy::value, "single-threaded by default");
+  static_assert(sizeof(shared_string) == sizeof(void*), "one pointer");
+  static_assert(sizeof(p) == sizeof(void*), "one pointer");
+
+  shared_string s = shared_string::make(3, 'a');
+  EXPECT_EQ("aaa", *s);
+  EXPECT_EQ(3u, s->size());
+  {
+    shared_string copy = s;
+    EXPECT_EQ(2u, s.use_count());
+    copy->append("b");
+  }
+  EXPECT_EQ("aaab", *s);
+  EXPECT_EQ(1u, s.use_count());
+
+  shared_string moved = std::move(s);
+  EXPECT_FALSE(s);
+  EXPECT_EQ(1u, moved.use_count());
+  moved.reset();
+  EXPECT_FALSE(moved);
+}
+
+struct destruction_counter {
+  explicit destruction_counter(std::atomic<int>* destroyed) : destroyed(destroyed) {}
+  ~destruction_counter() { destroyed->fetch_add(1); }
+  std::atomic<int>* destroyed;
+};
+
+TEST_F(POLICY, SmartPointerAcrossThreads) {
+  typedef smart_ptr<destruction_counter, ownership<reference_count>, multi_thread<true>> ptr;
+  std::atomic<int> destroyed{0};
+  {
+    ptr shared = ptr::make(&destroyed);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+      threads.emplace_back([shared] {
+        for (int i = 0; i < 10000; ++i) {
+          ptr copy = shared;
+          ptr another = copy;
+        }
+      });
+    }
+    for (auto& t : threads) t.join();
+    EXPECT_EQ(1u, shared.use_count());
+  }
+  EXPECT_EQ(1, destroyed.load());
+}
+
+struct throws_on_construction {
+  throws_on_construction() { throw std::runtime_error("construction"); }
+};
+
+// heap, counting the blocks it has handed out and not yet taken back.
+struct counted_heap {
+  static int outstanding;
+  static void* allocate(std::size_t bytes) {
+    void* p = heap::allocate(bytes);
+    ++outstanding;
+    return p;
+  }
+  static void deallocate(void* p, std::size_t bytes) {
+    --outstanding;
+    heap::deallocate(p, bytes);
+  }
+};
+
+int counted_heap::outstanding = 0;
+
+TEST_F(POLICY, ConstructorThrows) {
+  // The memory for an object whose constructor throws is given back.
+  EXPECT_THROW((smart_ptr<throws_on_construction, ownership<reference_count>,
+                          allocation<counted_heap>>::make()), std::runtime_error);
+  EXPECT_THROW((smart_ptr<throws_on_construction, ownership<deep_copy>, inline_size<0>,
+                          allocation<counted_heap>>::make()), std::runtime_error);
+  EXPECT_THROW((smart_ptr<throws_on_construction, ownership<biased_reference_count>,
+                          allocation<counted_heap>>::make()), std::runtime_error);
+  EXPECT_EQ(0, counted_heap::outstanding);
+}
+
+TEST_F(POLICY, BiasedReferenceCount) {
+  typedef smart_ptr<destruction_counter, ownership<biased_reference_count>> ptr;
+  std::atomic<int> destroyed{0};
+
+  // Other threads copy while the owner keeps its reference.
+  ptr shared = ptr::make(&destroyed);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([shared] {
+      for (int i = 0; i < 10000; ++i) {
+        ptr copy = shared;
+        ptr another = copy;
+      }
+    });
+  }
+  for (auto& t : threads) t.join();
+  shared.reset();
+  // The captured copies were made here but released on the other threads.
+  biased_reference_count::collect();
+  EXPECT_EQ(1, destroyed.load());
+
+  // The last reference dies on another thread: the object waits in the
+  // owner's queue until the owner collects.
+  shared = ptr::make(&destroyed);
+  std::thread([](ptr p) { p.reset(); }, std::move(shared)).join();
+  EXPECT_EQ(1, destroyed.load());
+  biased_reference_count::collect();
+  EXPECT_EQ(2, destroyed.load());
+
+  // The owner drops its references first; the other thread's release is
+  // then the last one and destroys the object at once.
+  shared = ptr::make(&destroyed);
+  ptr copy;
+  std::thread([&] { copy = shared; }).join();
+  shared.reset();
+  EXPECT_EQ(2, destroyed.load());
+  std::thread([&] { copy.reset(); }).join();
+  EXPECT_EQ(3, destroyed.load());
+
+  // Copies made on one thread and dropped on another leave one shard above
+  // zero and another below; the object lives on until the owner lets go.
+  shared = ptr::make(&destroyed);
+  std::vector<ptr> handed;
+  std::thread([&] {
+    for (int i = 0; i < 100; ++i) handed.push_back(shared);
+  }).join();
+  std::thread([&] { handed.clear(); }).join();
+  biased_reference_count::collect();
+  EXPECT_EQ(3, destroyed.load());
+  ptr last;
+  std::thread([&] { last = shared; }).join();
+  shared.reset();
+  EXPECT_EQ(3, destroyed.load());
+  last.reset();
+  EXPECT_EQ(4, destroyed.load());
+
+  // The owner exits while other threads still hold references.
+  ptr orphan;
+  std::thread([&] { orphan = ptr::make(&destroyed); }).join();
+  ptr orphan_copy = orphan;
+  EXPECT_EQ(4, destroyed.load());
+  orphan.reset();
+  orphan_copy.reset();
+  EXPECT_EQ(5, destroyed.load());
+}
+
+TEST_F(POLICY, DeepCopy) {
+  typedef smart_ptr<std::pair<int, int>, ownership<deep_copy>> small;
+  static_assert(small::stored_inline, "stored inline");
+  small a = small::make(1, 2);
+  const char* begin = reinterpret_cast<const char*>(&a);
+  const char* value = reinterpret_cast<const char*>(a.get());
+  EXPECT_TRUE(begin <= value && value < begin + sizeof(a));
+
+  small b = a;
+  b->first = 10;
+  EXPECT_EQ(1, a->first);
+  EXPECT_EQ(10, b->first);
+  small c = std::move(b);
+  EXPECT_FALSE(b);
+  a.swap(c);
+  EXPECT_EQ(10, a->first);
+  EXPECT_EQ(1, c->first);
+  a.swap(b);
+  EXPECT_FALSE(a);
+  EXPECT_EQ(10, b->first);
+
+  typedef smart_ptr<std::string, ownership<deep_copy>, inline_size<8>> large;
+  static_assert(!large::stored_inline, "stored on the heap");
+  static_assert(sizeof(large) == sizeof(void*), "one pointer");
+  large s = large::make("deep");
+  large t = s;
+  t->append(" copy");
+  EXPECT_EQ("deep", *s);
+  EXPECT_EQ("deep copy", *t);
+}
+
+TEST_F(POLICY, CopyOnWrite) {
+  typedef smart_ptr<std::vector<int>, ownership<copy_on_write>, multi_thread<true>> cow;
+  cow a = cow::make(1000, 7);
+  cow b = a;
+  static_assert(std::is_same<decltype(*b), const std::vector<int>&>::value, "read-only");
+
+  // Reads through a non-const pointer still share.
+  EXPECT_EQ(a.get(), b.get());
+  EXPECT_EQ(7, b->front());
+  EXPECT_EQ(1000u, (*b).size());
+  EXPECT_EQ(2u, a.use_count());
+
+  b.mutate()->front() = 8;
+  EXPECT_NE(a.get(), b.get());
+  EXPECT_EQ(7, a->front());
+  EXPECT_EQ(8, b->front());
+  EXPECT_EQ(1u, a.use_count());
+  EXPECT_EQ(1u, b.use_count());
+
+  const std::vector<int>* unique = b.get();
+  b.mutate()->back() = 9;
+  EXPECT_EQ(unique, b.get());
+}
+
+TEST_F(POLICY, AsyncLog) {
+  typedef async_log<level::info, block_on_overflow, 1024> log;
+  static_assert(!log::enabled<level::debug>::value, "filtered out");
+  static_assert(log::enabled<level::error>::value, "kept");
+
+  const std::string path = ::testing::TempDir() + "policy_async_log.txt";
+  std::remove(path.c_str());
+  log::logger().open(path);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([t] {
+      for (int i = 0; i < 500; ++i) log::log<level::warning>("thread ", t, " message ", i);
+    });
+  }
+  for (auto& t : threads) t.join();
+  log::log<level::debug>("never written");
+  log::log<level::error>(std::string("value "), 2.5);
+  char name[] = "mutable";
+  char* pointer = name;
+  log::log<level::info>(pointer, " name");
+  // Twice what a ring of 1024 bytes takes: the end of the long string goes.
+  log::log<level::error>("long ", std::string(1024, 'x'), " end");
+  hoge<log>().foo();
+  log::logger().flush();
+
+  std::ifstream in(path);
+  std::string line;
+  int messages = 0;
+  int last[4] = {-1, -1, -1, -1};
+  bool ordered = true;
+  std::vector<std::string> others;
+  while (std::getline(in, line)) {
+    int t = 0;
+    int i = 0;
+    if (std::sscanf(line.c_str(), "%*s WARNING thread %d message %d", &t, &i) == 2) {
+      ordered = ordered && i == last[t] + 1;
+      last[t] = i;
+      ++messages;
+    } else {
+      others.push_back(line.substr(line.find(' ') + 1));
+    }
+  }
+  EXPECT_EQ(2000, messages);
+  EXPECT_TRUE(ordered);
+  ASSERT_EQ(4u, others.size());
+  EXPECT_EQ("ERROR value 2.5", others[0]);
+  EXPECT_EQ("INFO mutable name", others[1]);
+  // 512 bytes less the header, three lengths and "long ".
+  const std::string truncated = "ERROR long " + std::string(512 - 24 - 12 - 5, 'x') + " [truncated]";
+  EXPECT_EQ(truncated, others[2]);
+  EXPECT_EQ("INFO Fatal Error", others[3]);
+  EXPECT_EQ(0u, log::logger().dropped());
+  std::remove(path.c_str());
+}
+
+TEST_F(POLICY, LogRing) {
+  log_ring ring(64);
+  auto write = [](char* at) {
+    const uint32_t header[2] = {24, 0};
+    std::memcpy(at, header, sizeof(header));
+  };
+  std::vector<log_ring::push_result> results;
+  for (log_ring::push_result r; (r = ring.try_push(24, write)) != log_ring::full;) {
+    results.push_back(r);
+  }
+  // The third record would need the filler as well. Only the first went
+  // into an empty ring, so only it wakes the writer.
+  EXPECT_EQ((std::vector<log_ring::push_result>{log_ring::pushed_into_empty, log_ring::pushed}),
+            results);
+  int read = 0;
+  ring.drain([&](const char*) { ++read; });
+  EXPECT_EQ(2, read);
+  EXPECT_TRUE(ring.empty());
+  EXPECT_EQ(log_ring::pushed_into_empty, ring.try_push(24, write));
+}
+
+template <class Allocation>
+void expect_allocates_and_frees() {
+  typedef smart_ptr<std::string, ownership<reference_count>, allocation<Allocation>> shared;
+  typedef smart_ptr<std::string, ownership<deep_copy>, inline_size<0>, allocation<Allocation>> value;
+  typedef smart_ptr<std::string, ownership<biased_reference_count>, allocation<Allocation>> biased;
+  for (int i = 0; i < 100; ++i) {
+    shared a = shared::make("shared");
+    shared b = a;
+    a.reset();
+    value c = value::make("value");
+    value d = c;
+    biased e = biased::make("biased");
+    EXPECT_EQ("shared", *b);
+    EXPECT_EQ("value", *d);
+    EXPECT_EQ("biased", *e);
+  }
+}
+
+TEST_F(POLICY, Allocation) {
+  static_assert(std::is_same<smart_ptr<int, ownership<reference_count>>::allocation_policy,
+                             allocation<heap>>::value, "heap by default");
+  expect_allocates_and_frees<heap>();
+  expect_allocates_and_frees<pool>();
+  expect_allocates_and_frees<thread_local_freelist>();
+
+  struct test_arena {};
+  expect_allocates_and_frees<arena<test_arena>>();
+  EXPECT_LT(0u, arena<test_arena>::bytes_used());
+  arena<test_arena>::release();
+  EXPECT_EQ(0u, arena<test_arena>::bytes_used());
+
+  // Freed blocks are reused.
+  void* p = pool::allocate(40);
+  pool::deallocate(p, 40);
+  EXPECT_EQ(p, pool::allocate(40));
+  pool::deallocate(p, 40);
+  void* large = pool::allocate(4096);
+  pool::deallocate(large, 4096);
+  // Zero bytes share the smallest class.
+  void* empty = pool::allocate(0);
+  pool::deallocate(empty, 0);
+  EXPECT_EQ(empty, pool::allocate(1));
+  pool::deallocate(empty, 1);
+}
+
+TEST_F(POLICY, ThreadLocalFreelist) {
+  // The header takes 16 bytes of each block.
+  EXPECT_EQ(32u, thread_local_freelist::block_size_for(0));
+  EXPECT_EQ(32u, thread_local_freelist::block_size_for(sizeof(double)));
+  EXPECT_EQ(32u, thread_local_freelist::block_size_for(16));
+  EXPECT_EQ(64u, thread_local_freelist::block_size_for(17));
+  EXPECT_EQ(1024u, thread_local_freelist::block_size_for(1008));
+  EXPECT_EQ(0u, thread_local_freelist::block_size_for(1009));
+
+  void* p = thread_local_freelist::allocate(100);
+  EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(p) % allocation_alignment);
+  thread_local_freelist::deallocate(p, 100);
+  void* q = thread_local_freelist::allocate(100);
+  EXPECT_EQ(p, q);
+
+  // Freed by another thread, the block returns to this thread's cache.
+  std::thread([q] { thread_local_freelist::deallocate(q, 100); }).join();
+  std::vector<void*> blocks;
+  bool returned = false;
+  for (std::size_t i = 0; i <= thread_local_freelist::blocks_per_slab && !returned; ++i) {
+    blocks.push_back(thread_local_freelist::allocate(100));
+    returned = blocks.back() == q;
+  }
+  EXPECT_TRUE(returned);
+  for (void* b : blocks) thread_local_freelist::deallocate(b, 100);
+
+  typedef smart_ptr<destruction_counter, ownership<reference_count>, multi_thread<true>,
+                    allocation<thread_local_freelist>> ptr;
+  std::atomic<int> destroyed{0};
+  std::vector<ptr> made_here;
+  for (int i = 0; i < 100; ++i) made_here.push_back(ptr::make(&destroyed));
+  std::thread([&] { made_here.clear(); }).join();
+  EXPECT_EQ(100, destroyed.load());
+  for (int i = 0; i < 100; ++i) made_here.push_back(ptr::make(&destroyed));
+  made_here.clear();
+  EXPECT_EQ(200, destroyed.load());
+
+  void* large = thread_local_freelist::allocate(5000);
+  thread_local_freelist::deallocate(large, 5000);
+}
+
+template <class Queue>
+void expect_delivers_everything(int producers, int consumers, int per_producer) {
+  std::unique_ptr<Queue> queue(new Queue);
+  std::atomic<long long> sum{0};
+  std::vector<std::thread> threads;
+  for (int p = 0; p < producers; ++p) {
+    threads.emplace_back([&] {
+      for (int i = 1; i <= per_producer; ++i) queue->push(i);
+    });
+  }
+  const int total = producers * per_producer;
+  for (int c = 0; c < consumers; ++c) {
+    threads.emplace_back([&, c] {
+      const int share = total / consumers + (c < total % consumers ? 1 : 0);
+      long long local = 0;
+      for (int i = 0; i < share; ++i) local += queue->pop();
+      sum += local;
+    });
+  }
+  for (auto& t : threads) t.join();
+  EXPECT_EQ(static_cast<long long>(producers) * per_producer * (per_producer + 1) / 2, sum.load());
+  int left = 0;
+  EXPECT_FALSE(queue->try_pop(left));
+}
+
+TEST_F(POLICY, BoundedQueue) {
+  typedef bounded_queue<int, topology<spsc>, capacity<64>, waiting<spin>> spsc_spin;
+  static_assert(std::is_same<spsc_spin::ring_type, spsc_ring<int, 64>>::value, "spsc ring");
+  static_assert(std::is_same<bounded_queue<int>::ring_type, mpmc_ring<int, 1024>>::value,
+                "mpmc ring by default");
+  static_assert(std::is_same<bounded_queue<int, topology<mpsc>>::ring_type,
+                             mpsc_ring<int, 1024>>::value, "mpsc ring");
+  static_assert(std::is_same<bounded_queue<int, topology<spsc>, multi_thread<false>>::ring_type,
+                             plain_ring<int, 1024>>::value, "plain ring");
+
+  expect_delivers_everything<spsc_spin>(1, 1, 20000);
+  expect_delivers_everything<bounded_queue<int, topology<spsc>, waiting<park>, capacity<16>>>(
+      1, 1, 20000);
+  expect_delivers_everything<bounded_queue<int, topology<mpsc>, waiting<yield>>>(4, 1, 5000);
+  expect_delivers_everything<bounded_queue<int, topology<mpsc>, waiting<park>, capacity<4>>>(
+      4, 1, 5000);
+  expect_delivers_everything<bounded_queue<int, topology<mpmc>, waiting<park>, capacity<8>>>(
+      4, 4, 5000);
+  expect_delivers_everything<bounded_queue<int, waiting<yield>, capacity<2>>>(3, 2, 3000);
+}
+
+TEST_F(POLICY, BoundedQueueSingleThread) {
+  bounded_queue<std::string, multi_thread<false>, capacity<2>> queue;
+  queue.push("first");
+  EXPECT_TRUE(queue.try_push(std::string("second")));
+  EXPECT_FALSE(queue.try_push(std::string("third")));
+  EXPECT_THROW(queue.push("third"), std::length_error);
+  EXPECT_EQ("first", queue.pop());
+  queue.push("third");
+  EXPECT_EQ("second", queue.pop());
+  EXPECT_EQ("third", queue.pop());
+  EXPECT_THROW(queue.pop(), std::out_of_range);
+
+  // Elements left in the queue are destroyed with it.
+  bounded_queue<smart_ptr<int, ownership<reference_count>>, topology<spsc>, capacity<4>> owners;
+  auto p = smart_ptr<int, ownership<reference_count>>::make(1);
+  owners.push(p);
+  EXPECT_EQ(2u, p.use_count());
+}
+
+// No default constructor, and counts the values alive.
+struct ticket {
+  static int alive;
+
+  explicit ticket(int n) : number(n) { ++alive; }
+  ticket(const ticket& other) : number(other.number) { ++alive; }
+  ~ticket() { --alive; }
+
+  int number;
+};
+
+int ticket::alive = 0;
+
+TEST_F(POLICY, BoundedQueueNoDefaultConstructor) {
+  {
+    bounded_queue<ticket, topology<spsc>, capacity<4>> spsc_tickets;
+    bounded_queue<ticket, capacity<4>> mpmc_tickets;
+    bounded_queue<ticket, multi_thread<false>, capacity<4>> plain_tickets;
+    for (int i = 0; i < 3; ++i) {
+      spsc_tickets.push(ticket(i));
+      mpmc_tickets.push(ticket(i));
+      plain_tickets.push(ticket(i));
+    }
+    EXPECT_EQ(0, spsc_tickets.pop().number);
+    EXPECT_EQ(0, mpmc_tickets.pop().number);
+    EXPECT_EQ(0, plain_tickets.pop().number);
+    EXPECT_EQ(6, ticket::alive);
+  }
+  // The rest are destroyed in place with the queues.
+  EXPECT_EQ(0, ticket::alive);
 }
 }  // namespace policy
@@ -0,0 +1,432 @@
+// Copyright <2018> <Tomoyuki Nakabayashi>
+// This software is released under the Apache 2.0 License, see LICENSE.
+
+// Runtime benchmarks for the policy classes. The code under test is the
+// test source itself; its tests are compiled in but not run.
+
+#include <deque>
+#include "policy.cpp"
+
+namespace bench {
+
+// Keeps the compiler from discarding a result nobody reads.
+template <typename T>
+void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Best time per call of f over a few rounds of at least 20 ms each.
+template <typename F>
+double ns_per_call(F&& f) {
+  typedef std::chrono::steady_clock clock;
+  std::size_t calls = 1;
+  double best = 0;
+  for (int round = 0; round < 5;) {
+    const auto start = clock::now();
+    for (std::size_t i = 0; i < calls; ++i) f();
+    const double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    if (ns < 20e6) {
+      calls *= 2;
+      continue;
+    }
+    if (round == 0 || ns / calls < best) best = ns / calls;
+    ++round;
+  }
+  return best;
+}
+
+void report(const char* name, std::size_t n, double ns) {
+  std::printf("%-40s %10zu %12.1f ns\n", name, n, ns);
+}
+
+}  // namespace bench
+
+namespace policy {
+
+// Copies one pointer into n slots and drops them again.
+template <class Pointer>
+void churn(const char* name, const Pointer& original, std::size_t n) {
+  std::vector<Pointer> copies(n);
+  bench::report(name, n, bench::ns_per_call([&] {
+    for (auto& copy : copies) copy = original;
+    bench::do_not_optimize(copies.data());
+    for (auto& copy : copies) copy.reset();
+  }));
+}
+
+void bench_reference_count() {
+  typedef smart_ptr<std::string, ownership<reference_count>> single_threaded;
+  typedef smart_ptr<std::string, ownership<reference_count>, multi_thread<true>> multi_threaded;
+  const std::size_t n = 64;
+  // libstdc++ skips the atomics of shared_ptr until the process has started
+  // a thread, so it is measured before and after one.
+  churn("copy+destroy/std::shared_ptr, no thread", std::make_shared<std::string>("shared"), n);
+  std::thread([] {}).join();
+  churn("copy+destroy/std::shared_ptr", std::make_shared<std::string>("shared"), n);
+  churn("copy+destroy/multi_thread<false>", single_threaded::make("shared"), n);
+  churn("copy+destroy/multi_thread<true>", multi_threaded::make("shared"), n);
+
+  bench::report("make+destroy/std::make_shared", 1, bench::ns_per_call([&] {
+    bench::do_not_optimize(std::make_shared<std::string>("shared"));
+  }));
+  bench::report("make+destroy/multi_thread<false>", 1, bench::ns_per_call([&] {
+    bench::do_not_optimize(single_threaded::make("shared"));
+  }));
+  bench::report("make+destroy/multi_thread<true>", 1, bench::ns_per_call([&] {
+    bench::do_not_optimize(multi_threaded::make("shared"));
+  }));
+}
+
+// Every thread copies and drops one shared pointer in a loop; the calling
+// thread, which made the object, is one of them. Reports wall time per
+// copy+destroy over all threads, for 1, 2, 4, ... threads up to the
+// hardware.
+template <class Pointer>
+void copy_scaling(const char* name, const Pointer& shared) {
+  const std::size_t copies = 1 << 20;
+  const std::size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t threads = 1;; threads = std::min(2 * threads, hardware)) {
+    std::atomic<bool> go{false};
+    auto work = [&] {
+      while (!go.load(std::memory_order_acquire)) {}
+      for (std::size_t i = 0; i < copies; ++i) {
+        Pointer copy = shared;
+        bench::do_not_optimize(copy.get());
+      }
+    };
+    std::vector<std::thread> others;
+    for (std::size_t t = 1; t < threads; ++t) others.emplace_back(work);
+    const auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    work();
+    for (auto& t : others) t.join();
+    const double ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+    bench::report(name, threads, ns / (copies * threads));
+    if (threads == hardware) break;
+  }
+}
+
+void bench_biased_reference_count() {
+  copy_scaling("copies across threads/std::shared_ptr", std::make_shared<std::string>("shared"));
+  typedef smart_ptr<std::string, ownership<reference_count>, multi_thread<true>> shared;
+  copy_scaling("copies across threads/reference_count", shared::make("shared"));
+  typedef smart_ptr<std::string, ownership<biased_reference_count>> biased;
+  copy_scaling("copies across threads/biased", biased::make("shared"));
+}
+
+template <std::size_t N>
+struct payload {
+  char bytes[N];
+};
+
+// A config value of N bytes copied, and copied then changed, with one heap
+// allocation per copy as the baseline.
+template <std::size_t N>
+void bench_value() {
+  typedef payload<N> value;
+  typedef smart_ptr<value, ownership<deep_copy>, inline_size<64>> deep;
+  typedef smart_ptr<value, ownership<copy_on_write>> cow;
+  const value initial = {};
+  const std::unique_ptr<value> heap(new value(initial));
+  const deep d = deep::make(initial);
+  const cow c = cow::make(initial);
+
+  bench::report("copy/new T(*p)", N, bench::ns_per_call([&] {
+    std::unique_ptr<value> copy(new value(*heap));
+    bench::do_not_optimize(copy->bytes);
+  }));
+  bench::report(deep::stored_inline ? "copy/deep_copy inline" : "copy/deep_copy heap", N,
+                bench::ns_per_call([&] {
+                  deep copy = d;
+                  bench::do_not_optimize(copy->bytes);
+                }));
+  bench::report("copy/copy_on_write", N, bench::ns_per_call([&] {
+    cow copy = c;
+    bench::do_not_optimize(copy->bytes);
+  }));
+  bench::report(deep::stored_inline ? "copy+mutate/deep_copy inline" : "copy+mutate/deep_copy heap",
+                N, bench::ns_per_call([&] {
+                  deep copy = d;
+                  copy->bytes[0] = 1;
+                  bench::do_not_optimize(copy->bytes);
+                }));
+  bench::report("copy+mutate/copy_on_write", N, bench::ns_per_call([&] {
+    cow copy = c;
+    copy.mutate()->bytes[0] = 1;
+    bench::do_not_optimize(copy->bytes);
+  }));
+}
+
+void bench_deep_copy() {
+  bench_value<16>();
+  bench_value<64>();
+  bench_value<1024>();
+}
+
+// A batch of 64 blocks allocated and then freed by one thread.
+template <class Allocation>
+void allocate_batch(const char* name, std::size_t bytes) {
+  std::vector<void*> blocks(64);
+  bench::report(name, bytes, bench::ns_per_call([&] {
+    for (auto& b : blocks) b = Allocation::allocate(bytes);
+    bench::do_not_optimize(blocks.data());
+    for (auto b : blocks) Allocation::deallocate(b, bytes);
+  }));
+}
+
+// Every thread allocates and frees one 48-byte block in a loop. Reports
+// wall time per allocate+deallocate over all threads, for 1, 2, 4, ...
+// threads up to the hardware.
+template <class Allocation>
+void allocate_scaling(const char* name) {
+  const std::size_t rounds = 1 << 20;
+  const std::size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+  for (std::size_t threads = 1;; threads = std::min(2 * threads, hardware)) {
+    std::atomic<bool> go{false};
+    auto work = [&] {
+      while (!go.load(std::memory_order_acquire)) {}
+      for (std::size_t i = 0; i < rounds; ++i) {
+        void* p = Allocation::allocate(48);
+        bench::do_not_optimize(p);
+        Allocation::deallocate(p, 48);
+      }
+    };
+    std::vector<std::thread> others;
+    for (std::size_t t = 1; t < threads; ++t) others.emplace_back(work);
+    const auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    work();
+    for (auto& t : others) t.join();
+    const double ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+    bench::report(name, threads, ns / (rounds * threads));
+    if (threads == hardware) break;
+  }
+}
+
+void bench_allocation() {
+  for (std::size_t bytes : {16, 48, 200, 1000}) {
+    allocate_batch<heap>("allocate+free x64/heap", bytes);
+    allocate_batch<pool>("allocate+free x64/pool", bytes);
+    allocate_batch<thread_local_freelist>("allocate+free x64/thread_local_freelist", bytes);
+  }
+  allocate_scaling<heap>("allocate+free across threads/heap");
+  allocate_scaling<pool>("allocate+free across threads/pool");
+  allocate_scaling<thread_local_freelist>("allocate+free across threads/freelist");
+}
+
+// The queue bounded_queue replaces: a mutex, a deque and a condition
+// variable for pop.
+template <class T>
+class locked_queue {
+ public:
+  void push(T value) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      items_.push_back(std::move(value));
+    }
+    not_empty_.notify_one();
+  }
+
+  T pop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    not_empty_.wait(lock, [&] { return !items_.empty(); });
+    T value = std::move(items_.front());
+    items_.pop_front();
+    return value;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::condition_variable not_empty_;
+  std::deque<T> items_;
+};
+
+// Wall time per item for 2^18 items pushed by the producers and popped by
+// the consumers, all started together.
+template <class Queue>
+void transfer(const char* name, std::size_t producers, std::size_t consumers) {
+  const std::size_t items = 1 << 18;
+  std::unique_ptr<Queue> queue(new Queue);
+  std::atomic<bool> go{false};
+  std::atomic<long long> sum{0};
+  std::vector<std::thread> threads;
+  for (std::size_t p = 0; p < producers; ++p) {
+    threads.emplace_back([&] {
+      while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+      for (std::size_t i = 0; i < items / producers; ++i) queue->push(static_cast<int>(i));
+    });
+  }
+  for (std::size_t c = 0; c < consumers; ++c) {
+    threads.emplace_back([&] {
+      while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+      long long local = 0;
+      for (std::size_t i = 0; i < items / consumers; ++i) local += queue->pop();
+      sum.fetch_add(local, std::memory_order_relaxed);
+    });
+  }
+  const auto start = std::chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto& t : threads) t.join();
+  const double ns = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count();
+  bench::do_not_optimize(sum.load());
+  bench::report(name, items, ns / items);
+}
+
+// Time for one item to go to another thread and back through a second queue.
+template <class Queue>
+void round_trip(const char* name) {
+  const std::size_t trips = 1 << 14;
+  std::unique_ptr<Queue> ping(new Queue);
+  std::unique_ptr<Queue> pong(new Queue);
+  std::thread echo([&] {
+    for (std::size_t i = 0; i < trips; ++i) pong->push(ping->pop());
+  });
+  const auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < trips; ++i) {
+    ping->push(static_cast<int>(i));
+    bench::do_not_optimize(pong->pop());
+  }
+  const double ns = std::chrono::duration<double, std::nano>(
+      std::chrono::steady_clock::now() - start).count();
+  echo.join();
+  bench::report(name, trips, ns / trips);
+}
+
+// One thread pushes 512 items and pops them again, so that only the cost of
+// the queue operations is left.
+template <class Queue>
+void single_thread(const char* name) {
+  const std::size_t items = 512;
+  Queue queue;
+  bench::report(name, items, bench::ns_per_call([&] {
+    for (std::size_t i = 0; i < items; ++i) queue.push(static_cast<int>(i));
+    long long sum = 0;
+    for (std::size_t i = 0; i < items; ++i) sum += queue.pop();
+    bench::do_not_optimize(sum);
+  }));
+}
+
+// std::deque with the same push/pop interface and no locking.
+template <class T>
+class unlocked_queue {
+ public:
+  void push(T value) { items_.push_back(std::move(value)); }
+
+  T pop() {
+    T value = std::move(items_.front());
+    items_.pop_front();
+    return value;
+  }
+
+ private:
+  std::deque<T> items_;
+};
+
+// Spinning waits for another thread to be scheduled, which on fewer cores
+// than threads takes a scheduler time slice per wait.
+bool can_spin(std::size_t threads) {
+  return std::thread::hardware_concurrency() >= threads;
+}
+
+// Every waiting strategy of one topology.
+template <class Topology>
+void transfer_waits(const char* config, const char* topology_name, std::size_t producers,
+                    std::size_t consumers) {
+  char name[64];
+  std::snprintf(name, sizeof(name), "%s/bounded_queue<%s>, yield", config, topology_name);
+  transfer<bounded_queue<int, topology<Topology>, waiting<yield>>>(name, producers, consumers);
+  std::snprintf(name, sizeof(name), "%s/bounded_queue<%s>, park", config, topology_name);
+  transfer<bounded_queue<int, topology<Topology>, waiting<park>>>(name, producers, consumers);
+  if (can_spin(producers + consumers)) {
+    std::snprintf(name, sizeof(name), "%s/bounded_queue<%s>, spin", config, topology_name);
+    transfer<bounded_queue<int, topology<Topology>, waiting<spin>>>(name, producers, consumers);
+  }
+}
+
+template <class Topology>
+void round_trip_waits(const char* topology_name) {
+  char name[64];
+  std::snprintf(name, sizeof(name), "round trip/bounded_queue<%s>, yield", topology_name);
+  round_trip<bounded_queue<int, topology<Topology>, waiting<yield>>>(name);
+  std::snprintf(name, sizeof(name), "round trip/bounded_queue<%s>, park", topology_name);
+  round_trip<bounded_queue<int, topology<Topology>, waiting<park>>>(name);
+  if (can_spin(2)) {
+    std::snprintf(name, sizeof(name), "round trip/bounded_queue<%s>, spin", topology_name);
+    round_trip<bounded_queue<int, topology<Topology>, waiting<spin>>>(name);
+  }
+}
+
+// Spin rows are left out where the hardware has fewer threads than the
+// benchmark.
+void bench_bounded_queue() {
+  single_thread<unlocked_queue<int>>("1 thread/std::deque");
+  single_thread<locked_queue<int>>("1 thread/mutex+deque");
+  single_thread<bounded_queue<int, multi_thread<false>>>("1 thread/bounded_queue, plain ring");
+  single_thread<bounded_queue<int, topology<spsc>>>("1 thread/bounded_queue<spsc>");
+  transfer<locked_queue<int>>("1 to 1/mutex+deque", 1, 1);
+  transfer_waits<spsc>("1 to 1", "spsc", 1, 1);
+  transfer<locked_queue<int>>("4 to 1/mutex+deque", 4, 1);
+  transfer_waits<mpsc>("4 to 1", "mpsc", 4, 1);
+  transfer_waits<mpmc>("4 to 1", "mpmc", 4, 1);
+  transfer<locked_queue<int>>("4 to 4/mutex+deque", 4, 4);
+  transfer_waits<mpmc>("4 to 4", "mpmc", 4, 4);
+  round_trip<locked_queue<int>>("round trip/mutex+deque");
+  round_trip_waits<spsc>("spsc");
+  round_trip_waits<mpsc>("mpsc");
+  round_trip_waits<mpmc>("mpmc");
+}
+
+// Every producer logs the same two-argument message; each call is timed on
+// its own, including the two clock reads. Throughput is wall time per
+// message until the writer has put all of them in the file.
+void bench_async_log() {
+  typedef async_log<level::info, block_on_overflow> log;
+  const std::string path = "policy_bench_log.txt";
+  log::logger().open(path);
+  const std::size_t messages = 1 << 14;
+  for (std::size_t producers = 1; producers <= 32; producers *= 2) {
+    std::vector<std::vector<float>> latencies(producers, std::vector<float>(messages));
+    std::atomic<bool> go{false};
+    auto work = [&](std::vector<float>& ns) {
+      typedef std::chrono::steady_clock clock;
+      while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+      for (std::size_t i = 0; i < messages; ++i) {
+        const auto start = clock::now();
+        log::log<level::info>("request ", i);
+        ns[i] = std::chrono::duration<float, std::nano>(clock::now() - start).count();
+      }
+    };
+    std::vector<std::thread> threads;
+    for (std::size_t t = 0; t < producers; ++t) threads.emplace_back(work, std::ref(latencies[t]));
+    const auto start = std::chrono::steady_clock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& t : threads) t.join();
+    log::logger().flush();
+    const double ns = std::chrono::duration<double, std::nano>(
+        std::chrono::steady_clock::now() - start).count();
+
+    std::vector<float> all;
+    for (const auto& l : latencies) all.insert(all.end(), l.begin(), l.end());
+    std::sort(all.begin(), all.end());
+    bench::report("async_log/p50 latency per call", producers, all[all.size() / 2]);
+    bench::report("async_log/p99 latency per call", producers, all[all.size() * 99 / 100]);
+    bench::report("async_log/wall time per message", producers, ns / all.size());
+  }
+  std::remove(path.c_str());
+}
+
+}  // namespace policy
+
+int main() {
+  std::printf("%-40s %10s %15s\n", "benchmark", "n", "time/call");
+  policy::bench_reference_count();
+  policy::bench_biased_reference_count();
+  policy::bench_deep_copy();
+  policy::bench_allocation();
+  policy::bench_bounded_queue();
+  policy::bench_async_log();
+  return 0;
+}
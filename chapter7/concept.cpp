@@ -1,10 +1,28 @@
 // Copyright <2018> <Tomoyuki Nakabayashi>
 // This software is released under the Apache 2.0 License, see LICENSE.
 
+// kernel::distances and kernel::square_roots use the widest of AVX-512, AVX
+// and SSE2 the target has. CONCEPT_SCALAR_DISTANCES keeps them, and the
+// distances over spans of points, to the plain loop, the only way to get
+// that path on x86-64, where SSE2 is always there.
+
 #include <gtest/gtest.h>
 #include <utility>
 #include <cmath>
+#include <cassert>
+#include <cstddef>
 #include <algorithm>
+#include <limits>
+#include <queue>
+#include <random>
+#include <thread>
+#include <vector>
+#if defined(CONCEPT_SCALAR_DISTANCES)
+#elif defined(__AVX__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 namespace concept {
 
@@ -87,6 +105,18 @@ struct point_traits<MyPoint> {
   }
 };
 
+template <>
+struct point_traits<std::pair<double, double>> {
+  typedef std::pair<double, double> point_type;
+
+  static double x(const point_type& p) { return p.first; }
+  static double y(const point_type& p) { return p.second; }
+
+  static point_type subtract(const point_type& a, const point_type& b) {
+    return std::make_pair(a.first - b.first, a.second - b.second);
+  }
+};
+
 template <class Point>
 double distance(Point a, Point b) {
   typedef point_traits<Point> traits;
@@ -123,6 +153,16 @@ struct get_geometry_category<point> {
   typedef point_category type;
 };
 
+template <>
+struct get_geometry_category<MyPoint> {
+  typedef point_category type;
+};
+
+template <>
+struct get_geometry_category<std::pair<double, double>> {
+  typedef point_category type;
+};
+
 template <class Point>
 class line_segment {
   Point p1_;
@@ -142,6 +182,76 @@ struct get_geometry_category<line_segment<Point>> {
   typedef line_segment_category type;
 };
 
+// Axis-aligned bounding box, also the query window of static_index.
+struct box {
+  double min_x = std::numeric_limits<double>::infinity();
+  double min_y = std::numeric_limits<double>::infinity();
+  double max_x = -std::numeric_limits<double>::infinity();
+  double max_y = -std::numeric_limits<double>::infinity();
+
+  box() = default;
+  box(double x1, double y1, double x2, double y2)
+      : min_x{std::min(x1, x2)}, min_y{std::min(y1, y2)},
+        max_x{std::max(x1, x2)}, max_y{std::max(y1, y2)} {}
+
+  void expand(const box& b) {
+    min_x = std::min(min_x, b.min_x);
+    min_y = std::min(min_y, b.min_y);
+    max_x = std::max(max_x, b.max_x);
+    max_y = std::max(max_y, b.max_y);
+  }
+
+  bool intersects(const box& b) const {
+    return min_x <= b.max_x && b.min_x <= max_x && min_y <= b.max_y && b.min_y <= max_y;
+  }
+
+  // Lower bound of the squared distance from (x, y) to anything inside.
+  double squared_distance(double x, double y) const {
+    const double dx = std::max(std::max(min_x - x, x - max_x), 0.0);
+    const double dy = std::max(std::max(min_y - y, y - max_y), 0.0);
+    return dx * dx + dy * dy;
+  }
+};
+
+template <class Point>
+box bounds_impl(const Point& p, point_category) {
+  typedef point_traits<Point> traits;
+  return box(traits::x(p), traits::y(p), traits::x(p), traits::y(p));
+}
+
+template <class LineSegment>
+box bounds_impl(const LineSegment& s, line_segment_category) {
+  typedef line_segment_traits<LineSegment> traits;
+  typedef point_traits<typename traits::point_type> points;
+  return box(points::x(traits::p1(s)), points::y(traits::p1(s)),
+             points::x(traits::p2(s)), points::y(traits::p2(s)));
+}
+
+template <class Point>
+double squared_distance_impl(double x, double y, const Point& p, point_category) {
+  typedef point_traits<Point> traits;
+  const double dx = traits::x(p) - x;
+  const double dy = traits::y(p) - y;
+  return dx * dx + dy * dy;
+}
+
+template <class LineSegment>
+double squared_distance_impl(double x, double y, const LineSegment& s, line_segment_category) {
+  typedef line_segment_traits<LineSegment> traits;
+  typedef point_traits<typename traits::point_type> points;
+  const double x1 = points::x(traits::p1(s));
+  const double y1 = points::y(traits::p1(s));
+  const double sx = points::x(traits::p2(s)) - x1;
+  const double sy = points::y(traits::p2(s)) - y1;
+  const double length2 = sx * sx + sy * sy;
+  // Project onto the segment and clamp to its end points.
+  const double t = length2 == 0.0 ? 0.0
+      : std::min(std::max(((x - x1) * sx + (y - y1) * sy) / length2, 0.0), 1.0);
+  const double dx = x1 + t * sx - x;
+  const double dy = y1 + t * sy - y;
+  return dx * dx + dy * dy;
+}
+
 template <class Point>
 double distance_impl(Point a, Point b, point_category, point_category) {
   typedef point_traits<Point> traits;
@@ -151,8 +261,8 @@ double distance_impl(Point a, Point b, point_category, point_category) {
 
 template <class Point, class LineSegment>
 double distance_impl(Point a, LineSegment b, point_category, line_segment_category) {
-  typedef line_segment_traits<LineSegment> traits;
-  return std::min(distance(a, traits::p1(b)), distance(a, traits::p2));
+  typedef point_traits<Point> traits;
+  return std::sqrt(squared_distance_impl(traits::x(a), traits::y(a), b, line_segment_category()));
 }
 
 template <class LineSegment, class Point>
@@ -173,7 +283,537 @@ TEST_F(CONCEPT, OverloadedDistance) {
   auto line = line_segment<point>(point(2.0, 2.0), point(3.0, 3.0));
 
   EXPECT_NEAR(4.24264, distance(p1, p2), 0.00001);
-  //EXPECT_NEAR(4.24264, distance(p1, line), 0.00001);
+  EXPECT_NEAR(2.82843, distance(p1, line), 0.00001);
+  EXPECT_NEAR(2.82843, distance(line, p1), 0.00001);
+  EXPECT_NEAR(0.70711, distance(point(3.0, 2.0), line), 0.00001);
+}
+
+// Batch distances. The kernels work on coordinates stored as separate x and
+// y arrays, so that one vector register holds the same coordinate of
+// several points; point_buffer keeps points in that form. The overloads for
+// spans of points read the coordinates in place and leave only the square
+// roots to a kernel.
+template <class T>
+class span {
+ public:
+  span() = default;
+  span(T* data, std::size_t size) : data_(data), size_(size) {}
+  template <class U>
+  span(std::vector<U>& v) : data_(v.data()), size_(v.size()) {}
+  template <class U>
+  span(const std::vector<U>& v) : data_(v.data()), size_(v.size()) {}
+
+  T* data() const { return data_; }
+  std::size_t size() const { return size_; }
+  T* begin() const { return data_; }
+  T* end() const { return data_ + size_; }
+  T& operator[](std::size_t i) const { return data_[i]; }
+
+ private:
+  T* data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+class point_buffer {
+ public:
+  point_buffer() = default;
+
+  template <class Point>
+  explicit point_buffer(span<const Point> points) {
+    reserve(points.size());
+    for (const Point& p : points) push_back(p);
+  }
+
+  template <class Point>
+  void push_back(const Point& p) {
+    xs_.push_back(point_traits<Point>::x(p));
+    ys_.push_back(point_traits<Point>::y(p));
+  }
+
+  void reserve(std::size_t n) {
+    xs_.reserve(n);
+    ys_.reserve(n);
+  }
+
+  std::size_t size() const { return xs_.size(); }
+  const double* xs() const { return xs_.data(); }
+  const double* ys() const { return ys_.data(); }
+
+ private:
+  std::vector<double> xs_;
+  std::vector<double> ys_;
+};
+
+namespace kernel {
+
+#if defined(__AVX512F__) && !defined(CONCEPT_SCALAR_DISTANCES)
+// Same instruction as _mm512_sqrt_pd, whose _mm512_undefined_pd operand
+// trips -Wmaybe-uninitialized in GCC 12.
+inline __m512d sqrt512(__m512d x) { return _mm512_maskz_sqrt_pd(0xFF, x); }
+#endif
+
+// out[i] = |(ax[i], ay[i]) - (bx[i], by[i])|. A stride of zero for a
+// repeats its first point, which gives the one-to-many form.
+inline void distances(const double* ax, const double* ay, std::size_t a_stride,
+                      const double* bx, const double* by, double* out, std::size_t n) {
+  std::size_t i = 0;
+#if defined(CONCEPT_SCALAR_DISTANCES)
+#elif defined(__AVX512F__)
+  if (a_stride == 0) {
+    const __m512d qx = _mm512_set1_pd(ax[0]);
+    const __m512d qy = _mm512_set1_pd(ay[0]);
+    for (; i + 8 <= n; i += 8) {
+      const __m512d dx = _mm512_sub_pd(qx, _mm512_loadu_pd(bx + i));
+      const __m512d dy = _mm512_sub_pd(qy, _mm512_loadu_pd(by + i));
+      _mm512_storeu_pd(out + i, sqrt512(_mm512_add_pd(_mm512_mul_pd(dx, dx),
+                                                      _mm512_mul_pd(dy, dy))));
+    }
+  } else {
+    for (; i + 8 <= n; i += 8) {
+      const __m512d dx = _mm512_sub_pd(_mm512_loadu_pd(ax + i), _mm512_loadu_pd(bx + i));
+      const __m512d dy = _mm512_sub_pd(_mm512_loadu_pd(ay + i), _mm512_loadu_pd(by + i));
+      _mm512_storeu_pd(out + i, sqrt512(_mm512_add_pd(_mm512_mul_pd(dx, dx),
+                                                      _mm512_mul_pd(dy, dy))));
+    }
+  }
+#elif defined(__AVX__)
+  if (a_stride == 0) {
+    const __m256d qx = _mm256_set1_pd(ax[0]);
+    const __m256d qy = _mm256_set1_pd(ay[0]);
+    for (; i + 4 <= n; i += 4) {
+      const __m256d dx = _mm256_sub_pd(qx, _mm256_loadu_pd(bx + i));
+      const __m256d dy = _mm256_sub_pd(qy, _mm256_loadu_pd(by + i));
+      _mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx),
+                                                             _mm256_mul_pd(dy, dy))));
+    }
+  } else {
+    for (; i + 4 <= n; i += 4) {
+      const __m256d dx = _mm256_sub_pd(_mm256_loadu_pd(ax + i), _mm256_loadu_pd(bx + i));
+      const __m256d dy = _mm256_sub_pd(_mm256_loadu_pd(ay + i), _mm256_loadu_pd(by + i));
+      _mm256_storeu_pd(out + i, _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx),
+                                                             _mm256_mul_pd(dy, dy))));
+    }
+  }
+#elif defined(__SSE2__)
+  for (; i + 2 <= n; i += 2) {
+    const __m128d px = a_stride == 0 ? _mm_set1_pd(ax[0]) : _mm_loadu_pd(ax + i);
+    const __m128d py = a_stride == 0 ? _mm_set1_pd(ay[0]) : _mm_loadu_pd(ay + i);
+    const __m128d dx = _mm_sub_pd(px, _mm_loadu_pd(bx + i));
+    const __m128d dy = _mm_sub_pd(py, _mm_loadu_pd(by + i));
+    _mm_storeu_pd(out + i, _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy))));
+  }
+#endif
+  for (; i < n; ++i) {
+    const double dx = ax[i * a_stride] - bx[i];
+    const double dy = ay[i * a_stride] - by[i];
+    out[i] = std::sqrt(dx * dx + dy * dy);
+  }
+}
+
+// values[i] = sqrt(values[i]). Kept out of the loops that compute the
+// squares, because std::sqrt may set errno and so keeps them scalar.
+inline void square_roots(double* values, std::size_t n) {
+  std::size_t i = 0;
+#if defined(CONCEPT_SCALAR_DISTANCES)
+#elif defined(__AVX512F__)
+  for (; i + 8 <= n; i += 8) _mm512_storeu_pd(values + i, sqrt512(_mm512_loadu_pd(values + i)));
+#elif defined(__AVX__)
+  for (; i + 4 <= n; i += 4) {
+    _mm256_storeu_pd(values + i, _mm256_sqrt_pd(_mm256_loadu_pd(values + i)));
+  }
+#elif defined(__SSE2__)
+  for (; i + 2 <= n; i += 2) _mm_storeu_pd(values + i, _mm_sqrt_pd(_mm_loadu_pd(values + i)));
+#endif
+  for (; i < n; ++i) values[i] = std::sqrt(values[i]);
+}
+
+}  // namespace kernel
+
+// Pairwise: out[i] = distance(a[i], b[i]).
+inline void distance(const point_buffer& a, const point_buffer& b, span<double> out) {
+  assert(a.size() == b.size() && out.size() >= a.size());
+  kernel::distances(a.xs(), a.ys(), 1, b.xs(), b.ys(), out.data(), a.size());
+}
+
+// One to many: out[i] = distance(q, points[i]).
+template <class Point>
+void distance(const Point& q, const point_buffer& points, span<double> out) {
+  assert(out.size() >= points.size());
+  const double qx = point_traits<Point>::x(q);
+  const double qy = point_traits<Point>::y(q);
+  kernel::distances(&qx, &qy, 0, points.xs(), points.ys(), out.data(), points.size());
+}
+
+// Points that are not in a point_buffer are read through their traits: a
+// block of squared distances goes into out, and the square roots are taken
+// while it is still in L1. The squares of a full block are computed with
+// a constant count, and out cannot alias the points, so GCC and Clang
+// vectorize the loop at -O2.
+const std::size_t distance_block = 256;
+
+template <class Point>
+inline void squared_distances(const Point* a, const Point* b, double* __restrict out,
+                              std::size_t n) {
+  typedef point_traits<Point> traits;
+  for (std::size_t i = 0; i < n; ++i) {
+    const double dx = traits::x(a[i]) - traits::x(b[i]);
+    const double dy = traits::y(a[i]) - traits::y(b[i]);
+    out[i] = dx * dx + dy * dy;
+  }
+}
+
+template <class Point>
+inline void squared_distances(double qx, double qy, const Point* points,
+                              double* __restrict out, std::size_t n) {
+  typedef point_traits<Point> traits;
+  for (std::size_t i = 0; i < n; ++i) {
+    const double dx = qx - traits::x(points[i]);
+    const double dy = qy - traits::y(points[i]);
+    out[i] = dx * dx + dy * dy;
+  }
+}
+
+template <class Point>
+void distance(span<const Point> a, span<const Point> b, span<double> out) {
+  assert(a.size() == b.size() && out.size() >= a.size());
+#if defined(CONCEPT_SCALAR_DISTANCES)
+  // Scalar square roots gain nothing from a pass of their own.
+  for (std::size_t i = 0; i < a.size(); ++i) out[i] = distance(a[i], b[i]);
+#else
+  for (std::size_t first = 0; first < a.size(); first += distance_block) {
+    const std::size_t n = std::min(distance_block, a.size() - first);
+    double* block = out.data() + first;
+    if (n == distance_block) {
+      squared_distances(a.data() + first, b.data() + first, block, distance_block);
+    } else {
+      squared_distances(a.data() + first, b.data() + first, block, n);
+    }
+    kernel::square_roots(block, n);
+  }
+#endif
+}
+
+template <class Point>
+void distance(const Point& q, span<const Point> points, span<double> out) {
+  assert(out.size() >= points.size());
+#if defined(CONCEPT_SCALAR_DISTANCES)
+  for (std::size_t i = 0; i < points.size(); ++i) out[i] = distance(q, points[i]);
+#else
+  typedef point_traits<Point> traits;
+  const double qx = traits::x(q);
+  const double qy = traits::y(q);
+  for (std::size_t first = 0; first < points.size(); first += distance_block) {
+    const std::size_t n = std::min(distance_block, points.size() - first);
+    double* block = out.data() + first;
+    if (n == distance_block) {
+      squared_distances(qx, qy, points.data() + first, block, distance_block);
+    } else {
+      squared_distances(qx, qy, points.data() + first, block, n);
+    }
+    kernel::square_roots(block, n);
+  }
+#endif
+}
+
+TEST_F(CONCEPT, BatchDistance) {
+  std::vector<MyPoint> a;
+  std::vector<MyPoint> b;
+  std::vector<std::pair<double, double>> pairs;
+  for (int i = 0; i < 1000; ++i) {
+    a.emplace_back(i * 0.5, -i * 0.25);
+    b.emplace_back(std::sin(i) * 100, std::cos(i) * 100);
+    pairs.emplace_back(std::sin(i) * 100, std::cos(i) * 100);
+  }
+
+  std::vector<double> out(a.size());
+  distance(span<const MyPoint>(a), span<const MyPoint>(b), out);
+  for (std::size_t i = 0; i < a.size(); ++i) EXPECT_DOUBLE_EQ(distance(a[i], b[i]), out[i]);
+
+  const point_buffer soa_a{span<const MyPoint>(a)};
+  const point_buffer soa_b{span<const MyPoint>(b)};
+  std::fill(out.begin(), out.end(), 0.0);
+  distance(soa_a, soa_b, out);
+  for (std::size_t i = 0; i < a.size(); ++i) EXPECT_DOUBLE_EQ(distance(a[i], b[i]), out[i]);
+
+  const std::pair<double, double> q(1.0, 2.0);
+  std::vector<double> to_q(pairs.size() - 3);  // An odd count leaves a scalar tail.
+  distance(q, span<const std::pair<double, double>>(pairs.data(), to_q.size()), to_q);
+  for (std::size_t i = 0; i < to_q.size(); ++i) {
+    EXPECT_DOUBLE_EQ(distance(q, pairs[i]), to_q[i]);
+  }
+
+  std::fill(out.begin(), out.end(), 0.0);
+  distance(point(1.0, 2.0), soa_b, out);
+  for (std::size_t i = 0; i < b.size(); ++i) EXPECT_DOUBLE_EQ(distance(q, pairs[i]), out[i]);
+}
+
+// Static spatial index over any geometry with a get_geometry_category: a
+// packed R-tree bulk loaded by Sort-Tile-Recursive. Every level is sorted
+// once, so loading is O(n log n), and the nodes and geometries live in two
+// flat arrays with children stored contiguously, nodes level by level from
+// the leaves up to the root. The index is immutable after construction and
+// queries only read it, so any number of threads may query it concurrently
+// without locking.
+template <class Geometry, std::size_t NodeCapacity = 16>
+class static_index {
+  static_assert(NodeCapacity >= 2, "NodeCapacity must be at least 2");
+
+ public:
+  typedef typename get_geometry_category<Geometry>::type category;
+
+  struct neighbour {
+    std::size_t index;  // position in the span the index was built from
+    double distance;
+  };
+
+  static_index() = default;
+
+  explicit static_index(span<const Geometry> geometries) {
+    std::vector<entry> entries(geometries.size());
+    for (std::size_t i = 0; i < geometries.size(); ++i) {
+      entries[i] = make_entry(bounds_impl(geometries[i], category()), i);
+    }
+    str_order(entries);
+
+    items_.reserve(entries.size());
+    ids_.reserve(entries.size());
+    for (const entry& e : entries) {
+      items_.push_back(geometries[e.index]);
+      ids_.push_back(e.index);
+    }
+    pack(entries, 0);
+    leaf_count_ = nodes_.size();
+
+    std::size_t begin = 0;
+    while (nodes_.size() - begin > 1) {
+      const std::size_t end = nodes_.size();
+      std::vector<entry> level(end - begin);
+      for (std::size_t i = begin; i < end; ++i) {
+        level[i - begin] = make_entry(nodes_[i].bounds, i);
+      }
+      str_order(level);
+      // Reordering a level is safe, since nodes refer to their children
+      // only by range and the level above does not exist yet.
+      std::vector<node> reordered;
+      reordered.reserve(level.size());
+      for (const entry& e : level) reordered.push_back(nodes_[e.index]);
+      std::copy(reordered.begin(), reordered.end(), nodes_.begin() + begin);
+      pack(level, begin);
+      begin = end;
+    }
+  }
+
+  std::size_t size() const { return items_.size(); }
+  bool empty() const { return items_.empty(); }
+
+  // The k geometries closest to q, nearest first.
+  template <class Point>
+  std::vector<neighbour> nearest(const Point& q, std::size_t k) const {
+    std::vector<neighbour> result;
+    if (empty() || k == 0) return result;
+    const double x = point_traits<Point>::x(q);
+    const double y = point_traits<Point>::y(q);
+
+    typedef std::pair<double, std::size_t> candidate;  // squared distance, position
+    std::priority_queue<candidate, std::vector<candidate>, std::greater<candidate>> frontier;
+    std::priority_queue<candidate> best;
+    const auto worst = [&]() {
+      return best.size() < k ? std::numeric_limits<double>::infinity() : best.top().first;
+    };
+
+    frontier.emplace(root().bounds.squared_distance(x, y), nodes_.size() - 1);
+    while (!frontier.empty() && frontier.top().first <= worst()) {
+      const node& n = nodes_[frontier.top().second];
+      frontier.pop();
+      for (std::size_t i = n.first; i < n.first + n.count; ++i) {
+        const double d = is_leaf(n) ? squared_distance_impl(x, y, items_[i], category())
+                                    : nodes_[i].bounds.squared_distance(x, y);
+        if (d > worst()) continue;
+        if (!is_leaf(n)) {
+          frontier.emplace(d, i);
+          continue;
+        }
+        if (best.size() == k) best.pop();
+        best.emplace(d, i);
+      }
+    }
+
+    result.resize(best.size());
+    for (std::size_t i = best.size(); i-- > 0; best.pop()) {
+      result[i] = neighbour{ids_[best.top().second], std::sqrt(best.top().first)};
+    }
+    return result;
+  }
+
+  // Calls f(neighbour) for every geometry within radius of q, in no
+  // particular order.
+  template <class Point, class F>
+  void within(const Point& q, double radius, F f) const {
+    const double x = point_traits<Point>::x(q);
+    const double y = point_traits<Point>::y(q);
+    const double radius2 = radius * radius;
+    visit([&](const box& b) { return b.squared_distance(x, y) <= radius2; },
+          [&](std::size_t i) {
+            const double d = squared_distance_impl(x, y, items_[i], category());
+            if (d <= radius2) f(neighbour{ids_[i], std::sqrt(d)});
+          });
+  }
+
+  // Calls f(index) for every geometry whose bounding box intersects window.
+  template <class F>
+  void intersecting(const box& window, F f) const {
+    visit([&](const box& b) { return b.intersects(window); },
+          [&](std::size_t i) {
+            if (bounds_impl(items_[i], category()).intersects(window)) f(ids_[i]);
+          });
+  }
+
+ private:
+  struct node {
+    box bounds;
+    std::size_t first;  // children: nodes_ or, for leaves, items_
+    std::size_t count;
+  };
+
+  struct entry {
+    box bounds;
+    double cx;
+    double cy;
+    std::size_t index;
+  };
+
+  static entry make_entry(const box& b, std::size_t index) {
+    return entry{b, (b.min_x + b.max_x) / 2, (b.min_y + b.max_y) / 2, index};
+  }
+
+  // Sort-Tile-Recursive: sort by x, cut into sqrt(#nodes) vertical slices
+  // and sort each slice by y, so runs of NodeCapacity entries are compact.
+  static void str_order(std::vector<entry>& entries) {
+    const std::size_t nodes = (entries.size() + NodeCapacity - 1) / NodeCapacity;
+    const std::size_t slices = static_cast<std::size_t>(std::ceil(std::sqrt(nodes)));
+    const std::size_t slice_size = std::max<std::size_t>(slices, 1) * NodeCapacity;
+    std::sort(entries.begin(), entries.end(),
+              [](const entry& a, const entry& b) { return a.cx < b.cx; });
+    for (std::size_t first = 0; first < entries.size(); first += slice_size) {
+      const std::size_t last = std::min(first + slice_size, entries.size());
+      std::sort(entries.begin() + first, entries.begin() + last,
+                [](const entry& a, const entry& b) { return a.cy < b.cy; });
+    }
+  }
+
+  // Appends one node per NodeCapacity consecutive entries; the children of
+  // the entry at position i are at first + i.
+  void pack(const std::vector<entry>& entries, std::size_t first) {
+    for (std::size_t i = 0; i < entries.size(); i += NodeCapacity) {
+      node n{box(), first + i, std::min(NodeCapacity, entries.size() - i)};
+      for (std::size_t j = i; j < i + n.count; ++j) n.bounds.expand(entries[j].bounds);
+      nodes_.push_back(n);
+    }
+  }
+
+  const node& root() const { return nodes_.back(); }
+  bool is_leaf(const node& n) const { return &n < nodes_.data() + leaf_count_; }
+
+  template <class Accept, class Visit>
+  void visit(Accept accept, Visit visit_item) const {
+    if (empty() || !accept(root().bounds)) return;
+    std::vector<std::size_t> stack(1, nodes_.size() - 1);
+    while (!stack.empty()) {
+      const node& n = nodes_[stack.back()];
+      stack.pop_back();
+      for (std::size_t i = n.first; i < n.first + n.count; ++i) {
+        if (is_leaf(n)) {
+          visit_item(i);
+        } else if (accept(nodes_[i].bounds)) {
+          stack.push_back(i);
+        }
+      }
+    }
+  }
+
+  std::vector<node> nodes_;
+  std::size_t leaf_count_ = 0;
+  std::vector<Geometry> items_;  // in leaf order
+  std::vector<std::size_t> ids_;  // items_[i] was geometries[ids_[i]]
+};
+
+TEST_F(CONCEPT, StaticIndex) {
+  std::mt19937 random(42);
+  std::uniform_real_distribution<double> coordinate(-1000.0, 1000.0);
+  std::vector<MyPoint> points;
+  for (int i = 0; i < 5000; ++i) points.emplace_back(coordinate(random), coordinate(random));
+  const static_index<MyPoint> index{span<const MyPoint>(points)};
+  EXPECT_EQ(points.size(), index.size());
+
+  for (int query = 0; query < 50; ++query) {
+    const MyPoint q(coordinate(random), coordinate(random));
+    std::vector<double> brute(points.size());
+    distance(q, span<const MyPoint>(points), brute);
+
+    const auto nearest = index.nearest(q, 7);
+    std::vector<double> sorted(brute);
+    std::sort(sorted.begin(), sorted.end());
+    ASSERT_EQ(7u, nearest.size());
+    for (std::size_t i = 0; i < nearest.size(); ++i) {
+      EXPECT_DOUBLE_EQ(sorted[i], nearest[i].distance);
+      EXPECT_DOUBLE_EQ(brute[nearest[i].index], nearest[i].distance);
+    }
+
+    std::size_t found = 0;
+    index.within(q, 100.0, [&](const static_index<MyPoint>::neighbour& n) {
+      EXPECT_LE(n.distance, 100.0);
+      EXPECT_DOUBLE_EQ(brute[n.index], n.distance);
+      ++found;
+    });
+    EXPECT_EQ(std::count_if(brute.begin(), brute.end(), [](double d) { return d <= 100.0; }),
+              static_cast<std::ptrdiff_t>(found));
+
+    const box window(q.getX() - 50.0, q.getY() - 20.0, q.getX() + 80.0, q.getY() + 30.0);
+    std::vector<std::size_t> hits;
+    index.intersecting(window, [&](std::size_t i) { hits.push_back(i); });
+    std::vector<std::size_t> expected;
+    for (std::size_t i = 0; i < points.size(); ++i) {
+      if (bounds_impl(points[i], point_category()).intersects(window)) expected.push_back(i);
+    }
+    std::sort(hits.begin(), hits.end());
+    EXPECT_EQ(expected, hits);
+  }
+
+  EXPECT_EQ(points.size(), index.nearest(MyPoint(0.0, 0.0), 10000).size());
+  EXPECT_TRUE(static_index<MyPoint>().nearest(MyPoint(0.0, 0.0), 3).empty());
+}
+
+TEST_F(CONCEPT, StaticIndexOfSegments) {
+  typedef line_segment<point> segment;
+  std::mt19937 random(7);
+  std::uniform_real_distribution<double> coordinate(-100.0, 100.0);
+  std::uniform_real_distribution<double> offset(-5.0, 5.0);
+  std::vector<segment> segments;
+  for (int i = 0; i < 2000; ++i) {
+    const point p(coordinate(random), coordinate(random));
+    segments.emplace_back(p, point(p.x() + offset(random), p.y() + offset(random)));
+  }
+  const static_index<segment, 8> index{span<const segment>(segments)};
+
+  // Queries only read the index, so threads share it without locking.
+  std::vector<std::thread> threads;
+  std::vector<int> mismatches(4, 0);
+  for (std::size_t t = 0; t < mismatches.size(); ++t) {
+    threads.emplace_back([&, t]() {
+      for (int query = 0; query < 25; ++query) {
+        const point q(std::sin(t * 100 + query) * 100, std::cos(t * 100 + query) * 100);
+        double closest = std::numeric_limits<double>::infinity();
+        for (const segment& s : segments) closest = std::min(closest, distance(q, s));
+        const auto nearest = index.nearest(q, 1);
+        if (nearest.size() != 1 || nearest[0].distance != closest ||
+            distance(q, segments[nearest[0].index]) != closest) {
+          ++mismatches[t];
+        }
+      }
+    });
+  }
+  for (std::thread& t : threads) t.join();
+  EXPECT_EQ(std::vector<int>(mismatches.size(), 0), mismatches);
 }
 
 }  // namespace concept
@@ -0,0 +1,184 @@
+// Copyright <2018> <Tomoyuki Nakabayashi>
+// This software is released under the Apache 2.0 License, see LICENSE.
+
+// Runtime benchmarks for the batch distance kernels and static_index. The
+// code under test is the test source itself; its tests are compiled in but
+// not run. Build it with -mavx, -mavx512f or CONCEPT_SCALAR_DISTANCES to
+// time the other paths of kernel::distances.
+
+#include <chrono>
+#include <cstdio>
+#include "concept.cpp"
+
+namespace bench {
+
+// Keeps the compiler from discarding a result nobody reads.
+template <typename T>
+void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Best time per call of f over a few rounds of at least 20 ms each.
+template <typename F>
+double ns_per_call(F&& f) {
+  typedef std::chrono::steady_clock clock;
+  std::size_t calls = 1;
+  double best = 0;
+  for (int round = 0; round < 5;) {
+    const auto start = clock::now();
+    for (std::size_t i = 0; i < calls; ++i) f();
+    const double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    if (ns < 20e6) {
+      calls *= 2;
+      continue;
+    }
+    if (round == 0 || ns / calls < best) best = ns / calls;
+    ++round;
+  }
+  return best;
+}
+
+void report(const char* name, std::size_t n, double ns) {
+  std::printf("%-40s %10zu %12.1f ns\n", name, n, ns);
+}
+
+}  // namespace bench
+
+namespace concept {
+
+const char* kernel_path() {
+#if defined(CONCEPT_SCALAR_DISTANCES)
+  return "scalar";
+#elif defined(__AVX512F__)
+  return "AVX-512";
+#elif defined(__AVX__)
+  return "AVX";
+#elif defined(__SSE2__)
+  return "SSE2";
+#else
+  return "scalar";
+#endif
+}
+
+// Time per batch, against distance() called for one pair at a time. The
+// span rows read the points in place, as the per-pair loop does.
+void bench_distances() {
+  for (std::size_t n : {16, 1000, 100000}) {
+    std::vector<MyPoint> a;
+    std::vector<MyPoint> b;
+    for (std::size_t i = 0; i < n; ++i) {
+      a.emplace_back(i * 0.5, -(i * 0.25));
+      b.emplace_back(std::sin(i) * 100, std::cos(i) * 100);
+    }
+    const point_buffer soa_a{span<const MyPoint>(a)};
+    const point_buffer soa_b{span<const MyPoint>(b)};
+    const MyPoint q(1.0, 2.0);
+    std::vector<double> out(n);
+
+    bench::report("pairwise/per-pair loop", n, bench::ns_per_call([&] {
+      for (std::size_t i = 0; i < n; ++i) out[i] = distance(a[i], b[i]);
+      bench::do_not_optimize(out.data());
+    }));
+    bench::report("pairwise/point_buffer", n, bench::ns_per_call([&] {
+      distance(soa_a, soa_b, out);
+      bench::do_not_optimize(out.data());
+    }));
+    bench::report("pairwise/span", n, bench::ns_per_call([&] {
+      distance(span<const MyPoint>(a), span<const MyPoint>(b), out);
+      bench::do_not_optimize(out.data());
+    }));
+    bench::report("one to many/per-pair loop", n, bench::ns_per_call([&] {
+      for (std::size_t i = 0; i < n; ++i) out[i] = distance(q, b[i]);
+      bench::do_not_optimize(out.data());
+    }));
+    bench::report("one to many/point_buffer", n, bench::ns_per_call([&] {
+      distance(q, soa_b, out);
+      bench::do_not_optimize(out.data());
+    }));
+    bench::report("one to many/span", n, bench::ns_per_call([&] {
+      distance(q, span<const MyPoint>(b), out);
+      bench::do_not_optimize(out.data());
+    }));
+  }
+}
+
+// Uniform points at a fixed density, one per 10 x 10 square, so that a
+// query of a given size finds about as many points at every n. Queries
+// cycle through 256 random centres; the linear scans test every point.
+void bench_static_index() {
+  for (std::size_t n : {10000, 100000, 1000000, 10000000}) {
+    const double side = std::sqrt(static_cast<double>(n)) * 10.0;
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> coordinate(0.0, side);
+    std::vector<MyPoint> points;
+    points.reserve(n);
+    for (std::size_t i = 0; i < n; ++i) points.emplace_back(coordinate(random), coordinate(random));
+    std::vector<MyPoint> queries;
+    for (int i = 0; i < 256; ++i) queries.emplace_back(coordinate(random), coordinate(random));
+    std::size_t next = 0;
+    auto query = [&]() -> const MyPoint& { return queries[next++ % queries.size()]; };
+
+    bench::report("STR bulk load/static_index", n, bench::ns_per_call([&] {
+      const static_index<MyPoint> index{span<const MyPoint>(points)};
+      bench::do_not_optimize(index.size());
+    }));
+    const static_index<MyPoint> index{span<const MyPoint>(points)};
+
+    const std::size_t k = 10;
+    bench::report("nearest 10/static_index", n, bench::ns_per_call([&] {
+      bench::do_not_optimize(index.nearest(query(), k).data());
+    }));
+    bench::report("nearest 10/linear scan", n, bench::ns_per_call([&] {
+      const MyPoint& q = query();
+      std::priority_queue<double> closest;  // the k smallest, largest on top
+      for (const MyPoint& p : points) {
+        const double d = distance(q, p);
+        if (closest.size() < k) {
+          closest.push(d);
+        } else if (d < closest.top()) {
+          closest.pop();
+          closest.push(d);
+        }
+      }
+      bench::do_not_optimize(closest.top());
+    }));
+
+    const double radius = 30.0;
+    bench::report("within 30/static_index", n, bench::ns_per_call([&] {
+      std::size_t found = 0;
+      index.within(query(), radius, [&](const static_index<MyPoint>::neighbour&) { ++found; });
+      bench::do_not_optimize(found);
+    }));
+    bench::report("within 30/linear scan", n, bench::ns_per_call([&] {
+      const MyPoint& q = query();
+      std::size_t found = 0;
+      for (const MyPoint& p : points) found += distance(q, p) <= radius;
+      bench::do_not_optimize(found);
+    }));
+
+    auto window = [](const MyPoint& q) {
+      return box(q.getX() - 30.0, q.getY() - 30.0, q.getX() + 30.0, q.getY() + 30.0);
+    };
+    bench::report("intersecting 60x60/static_index", n, bench::ns_per_call([&] {
+      std::size_t found = 0;
+      index.intersecting(window(query()), [&](std::size_t) { ++found; });
+      bench::do_not_optimize(found);
+    }));
+    bench::report("intersecting 60x60/linear scan", n, bench::ns_per_call([&] {
+      const box w = window(query());
+      std::size_t found = 0;
+      for (const MyPoint& p : points) found += bounds_impl(p, point_category()).intersects(w);
+      bench::do_not_optimize(found);
+    }));
+  }
+}
+
+}  // namespace concept
+
+int main() {
+  std::printf("kernel::distances path: %s\n", concept::kernel_path());
+  std::printf("%-40s %10s %15s\n", "benchmark", "n", "time/call");
+  concept::bench_distances();
+  concept::bench_static_index();
+  return 0;
+}
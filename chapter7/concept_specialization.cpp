@@ -96,7 +96,7 @@ struct is_point_category<std::pair<double, double>> {
 
 template <class T>
 struct get_geometry_category<T,
-    typename std::enable_if<geo::is_point_category<T>::value>> {
+    typename std::enable_if<geo::is_point_category<T>::value>::type> {
   typedef point_category type;
 };
 